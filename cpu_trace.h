@@ -0,0 +1,153 @@
+#ifndef __CPU_TRACE_H__
+#define __CPU_TRACE_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sb7 {
+	// Records where the CPU spends its time as nested scopes, for viewing in
+	// chrome://tracing or Perfetto. A scope object marks its own lifetime:
+	//
+	//     sb7::trace::scope trace("render");
+	//
+	// Each thread appends to a buffer of its own, so recording takes no lock
+	// and costs two clock reads; the buffers are only shared with write(),
+	// which may run on any thread while the others keep recording. A
+	// buffer that fills up drops further events rather than growing. Names
+	// must outlive the trace, in practice string literals.
+	namespace trace {
+		struct event {
+			const char *    name;
+			long long       begin;      // microseconds since the trace started
+			long long       end;
+		};
+
+		struct thread_buffer {
+			enum { CAPACITY = 1 << 16 };
+
+			thread_buffer(int id) : id(id), count(0), dropped(0), events(new event[CAPACITY]) {}
+
+			int                 id;
+			std::string         name;
+			std::atomic<int>    count;      // events published to write()
+			std::atomic<int>    dropped;
+			std::unique_ptr<event[]> events;
+		};
+
+		// Every thread's buffer, kept for the life of the process so that
+		// events of threads that have finished can still be written
+		struct registry {
+			std::mutex                  mutex;
+			std::vector<std::unique_ptr<thread_buffer> > buffers;
+			std::atomic<bool>           enabled;
+			std::chrono::steady_clock::time_point start;
+
+			registry() : enabled(false), start(std::chrono::steady_clock::now()) {}
+		};
+
+		inline registry & global() {
+			static registry r;
+			return r;
+		}
+
+		inline long long now() {
+			return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - global().start).count();
+		}
+
+		inline thread_buffer & local() {
+			static thread_local thread_buffer * buffer = nullptr;
+			if (!buffer) {
+				registry & r = global();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				r.buffers.emplace_back(new thread_buffer((int)r.buffers.size()));
+				buffer = r.buffers.back().get();
+			}
+			return *buffer;
+		}
+
+		inline void enable(bool on) {
+			global().enabled.store(on, std::memory_order_relaxed);
+		}
+
+		inline bool enabled() {
+			return global().enabled.load(std::memory_order_relaxed);
+		}
+
+		// Names the calling thread in the trace
+		inline void thread_name(const char * name) {
+			thread_buffer & b = local();
+			std::lock_guard<std::mutex> lock(global().mutex);
+			b.name = name;
+		}
+
+		class scope {
+		public:
+			explicit scope(const char * name) : name(enabled() ? name : nullptr), begin(0) {
+				if (this->name)
+					begin = now();
+			}
+
+			~scope() {
+				if (!name)
+					return;
+				thread_buffer & b = local();
+				int i = b.count.load(std::memory_order_relaxed);
+				if (i == thread_buffer::CAPACITY) {
+					b.dropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+				event & e = b.events[i];
+				e.name = name;
+				e.begin = begin;
+				e.end = now();
+				// Publish the event only once it is complete
+				b.count.store(i + 1, std::memory_order_release);
+			}
+
+		private:
+			scope(const scope &);
+			scope & operator=(const scope &);
+
+			const char *    name;
+			long long       begin;
+		};
+
+		// Writes everything recorded so far as Chrome trace event JSON and
+		// returns false if the file cannot be written
+		inline bool write(const std::string & filename) {
+			FILE * f = fopen(filename.c_str(), "w");
+			if (!f)
+				return false;
+			registry & r = global();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+			bool first = true;
+			for (size_t i = 0; i < r.buffers.size(); i++) {
+				const thread_buffer & b = *r.buffers[i];
+				if (!b.name.empty()) {
+					fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+							first ? "" : ",\n", b.id, b.name.c_str());
+					first = false;
+				}
+				int count = b.count.load(std::memory_order_acquire);
+				for (int j = 0; j < count; j++) {
+					const event & e = b.events[j];
+					fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+							first ? "" : ",\n", e.name, b.id, e.begin, e.end - e.begin);
+					first = false;
+				}
+				int dropped = b.dropped.load(std::memory_order_relaxed);
+				if (dropped)
+					fprintf(stderr, "Trace: %d events of thread %d dropped\n", dropped, b.id);
+			}
+			fprintf(f, "\n]}\n");
+			return fclose(f) == 0;
+		}
+	}
+}
+#endif /* __CPU_TRACE_H__ */
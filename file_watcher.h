@@ -0,0 +1,131 @@
+#ifndef __FILE_WATCHER_H__
+#define __FILE_WATCHER_H__
+
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+namespace sb7 {
+	// Reports files that have been rewritten since the last call to poll().
+	// On Linux the directories holding the watched files are registered with
+	// inotify and poll() is a single non-blocking read. Elsewhere the
+	// modification times of the files are compared every few polls.
+	class file_watcher {
+	public:
+		file_watcher() : fd(-1), polls(0) {
+#ifdef __linux__
+			fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+		}
+
+		~file_watcher() {
+#ifdef __linux__
+			if (fd >= 0)
+				close(fd);
+#endif
+		}
+
+		void watch(const std::string & filename) {
+			for (size_t i = 0; i < files.size(); i++) {
+				if (files[i].name == filename)
+					return;
+			}
+			watched_file file;
+			file.name = filename;
+			file.mtime = modification_time(filename);
+			files.push_back(file);
+
+#ifdef __linux__
+			if (fd < 0)
+				return;
+			size_t slash = filename.find_last_of('/');
+			std::string dir = slash == std::string::npos ? std::string() : filename.substr(0, slash + 1);
+			for (size_t i = 0; i < dirs.size(); i++) {
+				if (dirs[i].name == dir)
+					return;
+			}
+			// Editors commonly save by writing a temporary file and renaming
+			// it over the original, so renames count as changes too
+			watched_dir d;
+			d.name = dir;
+			d.wd = inotify_add_watch(fd, dir.empty() ? "." : dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+			if (d.wd >= 0)
+				dirs.push_back(d);
+#endif
+		}
+
+		// Appends the watched files that changed to changed and returns
+		// whether there were any.
+		bool poll(std::vector<std::string> & changed) {
+			size_t first = changed.size();
+#ifdef __linux__
+			if (fd >= 0) {
+				char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+				ssize_t len;
+				while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+					for (char * ptr = buffer; ptr < buffer + len; ) {
+						const struct inotify_event * event = (const struct inotify_event *)ptr;
+						ptr += sizeof(struct inotify_event) + event->len;
+						if (!event->len)
+							continue;
+						// The same directory may have been registered under
+						// different spellings; inotify hands all of them the same wd
+						for (size_t i = 0; i < dirs.size(); i++) {
+							if (dirs[i].wd == event->wd)
+								add_changed(dirs[i].name + event->name, changed);
+						}
+					}
+				}
+				return changed.size() > first;
+			}
+#endif
+			if (++polls % 30 != 0)
+				return false;
+			for (size_t i = 0; i < files.size(); i++) {
+				time_t mtime = modification_time(files[i].name);
+				if (mtime != files[i].mtime) {
+					files[i].mtime = mtime;
+					add_changed(files[i].name, changed);
+				}
+			}
+			return changed.size() > first;
+		}
+
+	private:
+		struct watched_file {
+			std::string name;
+			time_t      mtime;
+		};
+
+		struct watched_dir {
+			std::string name;
+			int         wd;
+		};
+
+		static time_t modification_time(const std::string & filename) {
+			struct stat st;
+			return stat(filename.c_str(), &st) == 0 ? st.st_mtime : 0;
+		}
+
+		void add_changed(const std::string & filename, std::vector<std::string> & changed) {
+			bool known = false;
+			for (size_t i = 0; i < files.size(); i++)
+				known |= files[i].name == filename;
+			for (size_t i = 0; i < changed.size(); i++)
+				known &= changed[i] != filename;
+			if (known)
+				changed.push_back(filename);
+		}
+
+		std::vector<watched_file> files;
+		std::vector<watched_dir>  dirs;
+		int                       fd;
+		unsigned int              polls;
+	};
+}
+#endif /* __FILE_WATCHER_H__ */
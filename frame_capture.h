@@ -0,0 +1,375 @@
+#ifndef __FRAME_CAPTURE_H__
+#define __FRAME_CAPTURE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gl3w.h"
+#include "cpu_trace.h"
+
+namespace sb7 {
+	// Writes rendered frames to disk without stalling the renderer. capture()
+	// has glReadPixels copy the frame into the next of a ring of pixel pack
+	// buffers and sets a fence; update() maps the buffers whose fence has
+	// signalled, a few frames later, and hands the mapped pixels to a writer
+	// thread, which encodes them while the GPU carries on. A buffer is
+	// unmapped and reused once the writer is done with it. Only when every
+	// buffer is still in use does capture() wait, which stalls() counts.
+	//
+	// The filename picks the format: a .ppm or .png name is a printf
+	// pattern for the frame number, one file per frame; anything else is
+	// one stream of raw top-down RGBA frames, as ffmpeg's rawvideo reads.
+	class frame_capture {
+	public:
+		enum format { PPM, PNG, RAW };
+
+		frame_capture() : kind(RAW), raw(nullptr), next(0), stall_count(0), written(0), failed(false), stopping(false) {}
+		~frame_capture() {}
+
+		// Call with a current context
+		bool init(const std::string & filename_pattern) {
+			pattern = filename_pattern;
+			size_t dot = pattern.rfind('.');
+			std::string extension = dot == std::string::npos ? "" : pattern.substr(dot);
+			kind = extension == ".ppm" ? PPM : extension == ".png" ? PNG : RAW;
+			if (kind != RAW && !is_frame_pattern(pattern)) {
+				fprintf(stderr, "frame_capture: %s needs exactly one integer conversion such as %%05d\n", pattern.c_str());
+				return false;
+			}
+			if (kind == RAW) {
+				raw = fopen(pattern.c_str(), "wb");
+				if (!raw)
+					return false;
+			}
+			for (int i = 0; i < SLOTS; i++) {
+				glGenBuffers(1, &slots[i].buffer);
+				slots[i].size = 0;
+				slots[i].fence = 0;
+				slots[i].state = FREE;
+			}
+			writer = std::thread(&frame_capture::write_frames, this);
+			return true;
+		}
+
+		// Queues the color of fbo (0 for the default framebuffer) for
+		// writing as frame number frame
+		void capture(GLuint fbo, GLsizei width, GLsizei height, int frame) {
+			slot & s = slots[next];
+			if (s.state != FREE) {
+				stall_count++;
+				while (s.state != FREE)
+					wait(s);
+			}
+			GLsizeiptr size = (GLsizeiptr)width * height * 4;
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+			if (size > s.size) {
+				glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+				s.size = size;
+			}
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+			if (fbo == 0)
+				glReadBuffer(GL_BACK);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			s.width = width;
+			s.height = height;
+			s.frame = frame;
+			s.state = READING;
+			next = (next + 1) % SLOTS;
+		}
+
+		// Passes finished copies on to the writer and recycles the buffers
+		// it is done with; once a frame
+		void update() {
+			for (int i = 0; i < SLOTS; i++)
+				poll(slots[(next + i) % SLOTS], false);
+		}
+
+		// Writes everything that was captured and stops the writer. Returns
+		// false if any frame failed to write.
+		bool finish() {
+			if (!writer.joinable())
+				return !failed;
+			for (int i = 0; i < SLOTS; i++) {
+				slot & s = slots[(next + i) % SLOTS];
+				while (s.state != FREE)
+					wait(s);
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			queue_changed.notify_all();
+			writer.join();
+			for (int i = 0; i < SLOTS; i++)
+				glDeleteBuffers(1, &slots[i].buffer);
+			if (raw && fclose(raw) != 0)
+				failed = true;
+			raw = nullptr;
+			return !failed;
+		}
+
+		int stalls() const { return stall_count; }
+		int frames_written() const { return written; }
+
+	private:
+		enum { SLOTS = 4 };
+		enum { FREE, READING, MAPPED, WRITTEN };
+
+		struct slot {
+			GLuint          buffer;
+			GLsizeiptr      size;
+			GLsync          fence;
+			GLsizei         width;
+			GLsizei         height;
+			int             frame;
+			const unsigned char * pixels;   // while mapped
+			std::atomic<int> state;         // WRITTEN is set by the writer
+		};
+
+		// Whether pattern is safe to hand to snprintf with the frame number:
+		// one d, i, u, x, X or o conversion with flags and a width at most,
+		// besides any number of %%
+		static bool is_frame_pattern(const std::string & pattern) {
+			int conversions = 0;
+			for (size_t i = 0; i < pattern.size(); i++) {
+				if (pattern[i] != '%')
+					continue;
+				if (++i < pattern.size() && pattern[i] == '%')
+					continue;
+				i = pattern.find_first_not_of("-+ #0123456789", i);
+				if (i == std::string::npos || !strchr("diuxXo", pattern[i]))
+					return false;
+				conversions++;
+			}
+			return conversions == 1;
+		}
+
+		// Moves s on by one state if it can, waiting for the GPU or the
+		// writer if block is set
+		void poll(slot & s, bool block) {
+			std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+			switch (s.state.load()) {
+			case READING: {
+				GLenum status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, block ? 1000000000 : 0);
+				if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+					return;
+				glDeleteSync(s.fence);
+				s.fence = 0;
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+				s.pixels = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)s.width * s.height * 4, GL_MAP_READ_BIT);
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+				lock.lock();
+				s.state = MAPPED;
+				queue.push_back(&s);
+				lock.unlock();
+				queue_changed.notify_all();
+				break;
+			}
+			case MAPPED:
+				if (block) {
+					lock.lock();
+					frame_written.wait(lock, [&] { return s.state != MAPPED; });
+					lock.unlock();
+				}
+				if (s.state == MAPPED)
+					return;
+				// fall through
+			case WRITTEN:
+				if (s.pixels) {
+					glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+					glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+					glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+				}
+				s.pixels = nullptr;
+				s.state = FREE;
+				break;
+			default:
+				break;
+			}
+		}
+
+		void wait(slot & s) {
+			poll(s, true);
+		}
+
+		void write_frames() {
+			trace::thread_name("capture writer");
+			std::vector<unsigned char> rows;
+			for (;;) {
+				slot * s;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					queue_changed.wait(lock, [&] { return stopping || !queue.empty(); });
+					if (queue.empty())
+						return;
+					s = queue.front();
+					queue.pop_front();
+				}
+				{
+					trace::scope trace("encode frame");
+					if (!write_frame(*s, rows))
+						failed = true;
+					else
+						written++;
+				}
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					s->state = WRITTEN;
+				}
+				frame_written.notify_all();
+			}
+		}
+
+		// Writes the frame in s, flipped to top-down rows of RGB or, for raw
+		// streams, RGBA
+		bool write_frame(const slot & s, std::vector<unsigned char> & rows) {
+			if (!s.pixels)
+				return false;
+			int channels = kind == RAW ? 4 : 3;
+			size_t stride = (size_t)s.width * channels;
+			rows.resize(stride * s.height);
+			for (GLsizei y = 0; y < s.height; y++) {
+				const unsigned char * src = s.pixels + (size_t)(s.height - 1 - y) * s.width * 4;
+				unsigned char * dst = &rows[y * stride];
+				if (channels == 4) {
+					memcpy(dst, src, stride);
+				} else {
+					for (GLsizei x = 0; x < s.width; x++, src += 4, dst += 3) {
+						dst[0] = src[0];
+						dst[1] = src[1];
+						dst[2] = src[2];
+					}
+				}
+			}
+			if (kind == RAW)
+				return fwrite(rows.data(), 1, rows.size(), raw) == rows.size();
+
+			char filename[1024];
+			snprintf(filename, sizeof(filename), pattern.c_str(), s.frame);
+			FILE * f = fopen(filename, "wb");
+			if (!f)
+				return false;
+			bool ok = kind == PPM ? write_ppm(f, s.width, s.height, rows) : write_png(f, s.width, s.height, rows);
+			return fclose(f) == 0 && ok;
+		}
+
+		static bool write_ppm(FILE * f, int width, int height, const std::vector<unsigned char> & rgb) {
+			fprintf(f, "P6\n%d %d\n255\n", width, height);
+			return fwrite(rgb.data(), 1, rgb.size(), f) == rgb.size();
+		}
+
+		static unsigned int crc32(const unsigned char * data, size_t size, unsigned int crc) {
+			static unsigned int table[256];
+			static bool table_ready = false;
+			if (!table_ready) {
+				for (unsigned int n = 0; n < 256; n++) {
+					unsigned int c = n;
+					for (int k = 0; k < 8; k++)
+						c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+					table[n] = c;
+				}
+				table_ready = true;
+			}
+			crc = ~crc;
+			for (size_t i = 0; i < size; i++)
+				crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+			return ~crc;
+		}
+
+		static void put_u32(std::vector<unsigned char> & out, unsigned int v) {
+			out.push_back((unsigned char)(v >> 24));
+			out.push_back((unsigned char)(v >> 16));
+			out.push_back((unsigned char)(v >> 8));
+			out.push_back((unsigned char)v);
+		}
+
+		static bool write_chunk(FILE * f, const char * type, const std::vector<unsigned char> & data) {
+			std::vector<unsigned char> chunk;
+			put_u32(chunk, (unsigned int)data.size());
+			chunk.insert(chunk.end(), type, type + 4);
+			chunk.insert(chunk.end(), data.begin(), data.end());
+			put_u32(chunk, crc32(&chunk[4], chunk.size() - 4, 0));
+			return fwrite(chunk.data(), 1, chunk.size(), f) == chunk.size();
+		}
+
+		// 8 bit RGB PNG in stored (uncompressed) deflate blocks: encoding
+		// costs a copy and a checksum, so the writer keeps up with the
+		// renderer, at the price of files as large as PPMs
+		static bool write_png(FILE * f, int width, int height, const std::vector<unsigned char> & rgb) {
+			static const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			std::vector<unsigned char> header, image, data;
+			size_t stride = (size_t)width * 3;
+			int y;
+
+			put_u32(header, width);
+			put_u32(header, height);
+			header.push_back(8);    // bits per channel
+			header.push_back(2);    // RGB
+			header.push_back(0);
+			header.push_back(0);
+			header.push_back(0);
+
+			// Every row starts with its filter, none
+			image.reserve((stride + 1) * height);
+			for (y = 0; y < height; y++) {
+				image.push_back(0);
+				image.insert(image.end(), rgb.begin() + y * stride, rgb.begin() + (y + 1) * stride);
+			}
+
+			unsigned int a = 1, b = 0;
+			for (size_t i = 0; i < image.size(); i++) {
+				a = (a + image[i]) % 65521;
+				b = (b + a) % 65521;
+			}
+			data.reserve(image.size() + image.size() / 65535 * 5 + 16);
+			data.push_back(0x78);
+			data.push_back(0x01);
+			for (size_t offset = 0; offset < image.size() || offset == 0; ) {
+				size_t length = std::min(image.size() - offset, (size_t)65535);
+				bool last = offset + length == image.size();
+				data.push_back(last ? 1 : 0);
+				data.push_back((unsigned char)length);
+				data.push_back((unsigned char)(length >> 8));
+				data.push_back((unsigned char)~length);
+				data.push_back((unsigned char)(~length >> 8));
+				data.insert(data.end(), image.begin() + offset, image.begin() + offset + length);
+				offset += length;
+				if (last)
+					break;
+			}
+			put_u32(data, b << 16 | a);
+
+			return fwrite(signature, 1, sizeof(signature), f) == sizeof(signature) &&
+				   write_chunk(f, "IHDR", header) &&
+				   write_chunk(f, "IDAT", data) &&
+				   write_chunk(f, "IEND", std::vector<unsigned char>());
+		}
+
+		format              kind;
+		std::string         pattern;
+		FILE *              raw;
+		slot                slots[SLOTS];
+		int                 next;
+		int                 stall_count;
+		std::atomic<int>    written;
+		std::atomic<bool>   failed;
+
+		std::thread         writer;
+		std::mutex          mutex;
+		std::condition_variable queue_changed;
+		std::condition_variable frame_written;
+		std::deque<slot *>  queue;
+		bool                stopping;
+	};
+}
+#endif /* __FRAME_CAPTURE_H__ */
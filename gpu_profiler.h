@@ -0,0 +1,137 @@
+#ifndef __GPU_PROFILER_H__
+#define __GPU_PROFILER_H__
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "gpu_timer.h"
+
+namespace sb7 {
+	// Times named passes of every frame on the GPU and keeps the last
+	// HISTORY measurements of each, from which report() prints the minimum,
+	// average and 99th percentile. Each pass has its own gpu_timer, so the
+	// results are read back a few frames late and the passes may nest or
+	// overlap without the CPU ever waiting for the GPU.
+	class gpu_profiler {
+	public:
+		enum { HISTORY = 512 };
+
+		gpu_profiler() : generation(0) {}
+		~gpu_profiler() {}
+
+		// Registers a pass and returns the index begin() and end() take;
+		// call with a current context
+		int add(const char * name) {
+			passes.push_back(pass());
+			pass & p = passes.back();
+			p.name = name;
+			p.timer.init();
+			p.count = 0;
+			p.next = 0;
+			p.skip = true;
+			return (int)passes.size() - 1;
+		}
+
+		void free() {
+			for (size_t i = 0; i < passes.size(); i++)
+				passes[i].timer.free();
+			passes.clear();
+		}
+
+		void begin(int index) {
+			passes[index].timer.begin(generation);
+		}
+
+		void end(int index) {
+			passes[index].timer.end();
+		}
+
+		// Collects the measurements that have become available; once a frame
+		void update() {
+			float ms;
+			unsigned int tag;
+
+			for (size_t i = 0; i < passes.size(); i++) {
+				pass & p = passes[i];
+				while (p.timer.poll(ms, tag)) {
+					if (tag != generation)
+						continue;
+					// The first frame pays for one-time uploads, and some
+					// drivers return garbage for the very first query
+					if (p.skip) {
+						p.skip = false;
+						continue;
+					}
+					p.samples[p.next] = ms;
+					p.next = (p.next + 1) % HISTORY;
+					p.count = std::min(p.count + 1, (int)HISTORY);
+				}
+			}
+		}
+
+		// Forgets every measurement, including the ones still in flight
+		void reset() {
+			generation++;
+			for (size_t i = 0; i < passes.size(); i++) {
+				passes[i].count = 0;
+				passes[i].next = 0;
+				passes[i].skip = true;
+			}
+		}
+
+		int size() const {
+			return (int)passes.size();
+		}
+
+		const char * name(int index) const {
+			return passes[index].name.c_str();
+		}
+
+		// The minimum, average and 99th percentile of a pass's measurements
+		// kept; returns how many those are, 0 leaving the statistics unset
+		int statistics(int index, float & min, float & avg, float & p99) const {
+			const pass & p = passes[index];
+			if (!p.count)
+				return 0;
+			std::vector<float> sorted(p.samples, p.samples + p.count);
+			std::sort(sorted.begin(), sorted.end());
+			double sum = 0.0;
+			for (int j = 0; j < p.count; j++)
+				sum += sorted[j];
+			min = sorted[0];
+			avg = (float)(sum / p.count);
+			// Nearest rank
+			p99 = sorted[std::min((p.count * 99 + 99) / 100, p.count) - 1];
+			return p.count;
+		}
+
+		void report(FILE * f) const {
+			float min, avg, p99;
+
+			fprintf(f, "%-12s %8s %8s %8s %8s\n", "GPU pass", "frames", "min ms", "avg ms", "p99 ms");
+			for (int i = 0; i < size(); i++) {
+				int count = statistics(i, min, avg, p99);
+				if (count)
+					fprintf(f, "%-12s %8d %8.3f %8.3f %8.3f\n", name(i), count, min, avg, p99);
+				else
+					fprintf(f, "%-12s %8d %8s %8s %8s\n", name(i), 0, "-", "-", "-");
+			}
+		}
+
+	private:
+		struct pass {
+			std::string     name;
+			gpu_timer       timer;
+			float           samples[HISTORY];
+			int             count;      // valid samples, up to HISTORY
+			int             next;       // where the next one goes
+			bool            skip;       // the next measurement
+		};
+
+		std::vector<pass>   passes;
+		unsigned int        generation;
+	};
+}
+#endif /* __GPU_PROFILER_H__ */
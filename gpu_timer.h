@@ -0,0 +1,81 @@
+#ifndef __GPU_TIMER_H__
+#define __GPU_TIMER_H__
+
+#include "gl3w.h"
+
+namespace sb7 {
+	// Measures how long the GPU takes for the commands between begin() and
+	// end(), once per frame, with a pair of timestamp queries. The pairs are
+	// kept in a ring so that each result is read back a few frames later,
+	// once it is available, rather than waiting for the GPU. Every
+	// measurement carries the tag it was begun with, which lets the caller
+	// drop results still in flight from before it changed a setting. Unlike
+	// GL_TIME_ELAPSED queries, timers may overlap.
+	class gpu_timer {
+	public:
+		gpu_timer() : next(0), active(false) {
+			for (int i = 0; i < DEPTH; i++)
+				pending[i] = false;
+		}
+		~gpu_timer() {}
+
+		void init() {
+			glGenQueries(DEPTH * 2, queries);
+		}
+
+		void free() {
+			glDeleteQueries(DEPTH * 2, queries);
+		}
+
+		// While every slot of the ring still waits for its result the frame
+		// goes unmeasured
+		void begin(unsigned int tag) {
+			active = !pending[next];
+			if (!active)
+				return;
+			tags[next] = tag;
+			glQueryCounter(queries[next * 2], GL_TIMESTAMP);
+		}
+
+		void end() {
+			if (!active)
+				return;
+			glQueryCounter(queries[next * 2 + 1], GL_TIMESTAMP);
+			pending[next] = true;
+			next = (next + 1) % DEPTH;
+			active = false;
+		}
+
+		// Takes the oldest measurement if it has finished: its duration in
+		// milliseconds and its tag. Call until it returns false.
+		bool poll(float & ms, unsigned int & tag) {
+			for (int i = 0; i < DEPTH; i++) {
+				int slot = (next + i) % DEPTH;
+				if (!pending[slot])
+					continue;
+				GLint available = 0;
+				glGetQueryObjectiv(queries[slot * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available)
+					return false;
+				GLuint64 start, stop;
+				glGetQueryObjectui64v(queries[slot * 2], GL_QUERY_RESULT, &start);
+				glGetQueryObjectui64v(queries[slot * 2 + 1], GL_QUERY_RESULT, &stop);
+				pending[slot] = false;
+				ms = (float)((stop - start) / 1.0e6);
+				tag = tags[slot];
+				return true;
+			}
+			return false;
+		}
+
+	private:
+		enum { DEPTH = 4 };
+
+		GLuint          queries[DEPTH * 2];
+		unsigned int    tags[DEPTH];
+		bool            pending[DEPTH];
+		int             next;
+		bool            active;
+	};
+}
+#endif /* __GPU_TIMER_H__ */
@@ -0,0 +1,100 @@
+#ifndef __IMAGE_COMPARE_H__
+#define __IMAGE_COMPARE_H__
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace sb7 {
+	// 8 bit RGB images, top row first, and the measures the golden image
+	// check compares them with
+	namespace image {
+		struct rgb {
+			int                         width;
+			int                         height;
+			std::vector<unsigned char>  pixels;
+
+			rgb() : width(0), height(0) {}
+		};
+
+		inline bool load_ppm(const std::string & filename, rgb & image) {
+			FILE * f = fopen(filename.c_str(), "rb");
+			if (!f)
+				return false;
+			int max_value = 0;
+			bool ok = fscanf(f, "P6 %d %d %d", &image.width, &image.height, &max_value) == 3 &&
+					  max_value == 255 && image.width > 0 && image.height > 0 && fgetc(f) != EOF;
+			if (ok) {
+				image.pixels.resize((size_t)image.width * image.height * 3);
+				ok = fread(image.pixels.data(), 1, image.pixels.size(), f) == image.pixels.size();
+			}
+			fclose(f);
+			return ok;
+		}
+
+		inline bool store_ppm(const std::string & filename, const rgb & image) {
+			FILE * f = fopen(filename.c_str(), "wb");
+			if (!f)
+				return false;
+			fprintf(f, "P6\n%d %d\n255\n", image.width, image.height);
+			bool ok = fwrite(image.pixels.data(), 1, image.pixels.size(), f) == image.pixels.size();
+			return fclose(f) == 0 && ok;
+		}
+
+		// Peak signal to noise ratio over all channels in dB, capped at 100
+		// for identical images
+		inline double psnr(const rgb & a, const rgb & b) {
+			double error = 0.0;
+			for (size_t i = 0; i < a.pixels.size(); i++) {
+				double d = (double)a.pixels[i] - b.pixels[i];
+				error += d * d;
+			}
+			error /= a.pixels.size();
+			return error > 0.0 ? fmin(10.0 * log10(255.0 * 255.0 / error), 100.0) : 100.0;
+		}
+
+		// Mean structural similarity (Wang et al. 2004) of the luma, over
+		// 8x8 windows every 4 pixels. Unlike PSNR it weighs a loss of
+		// structure, such as blurred or noisy occlusion, above an even shift
+		// in brightness.
+		inline double ssim(const rgb & a, const rgb & b) {
+			const int window = 8, step = 4;
+			const double c1 = (0.01 * 255.0) * (0.01 * 255.0);
+			const double c2 = (0.03 * 255.0) * (0.03 * 255.0);
+			std::vector<float> la(a.width * a.height), lb(b.width * b.height);
+			int x, y, i, j;
+
+			for (i = 0; i < a.width * a.height; i++) {
+				la[i] = 0.299f * a.pixels[i * 3] + 0.587f * a.pixels[i * 3 + 1] + 0.114f * a.pixels[i * 3 + 2];
+				lb[i] = 0.299f * b.pixels[i * 3] + 0.587f * b.pixels[i * 3 + 1] + 0.114f * b.pixels[i * 3 + 2];
+			}
+
+			double total = 0.0;
+			int windows = 0;
+			for (y = 0; y + window <= a.height; y += step) {
+				for (x = 0; x + window <= a.width; x += step) {
+					double sa = 0.0, sb = 0.0, saa = 0.0, sbb = 0.0, sab = 0.0;
+					for (j = 0; j < window; j++) {
+						for (i = 0; i < window; i++) {
+							double va = la[(y + j) * a.width + x + i];
+							double vb = lb[(y + j) * a.width + x + i];
+							sa += va;
+							sb += vb;
+							saa += va * va;
+							sbb += vb * vb;
+							sab += va * vb;
+						}
+					}
+					const double n = window * window;
+					double ma = sa / n, mb = sb / n;
+					double va = saa / n - ma * ma, vb = sbb / n - mb * mb, cov = sab / n - ma * mb;
+					total += ((2.0 * ma * mb + c1) * (2.0 * cov + c2)) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+					windows++;
+				}
+			}
+			return windows ? total / windows : 1.0;
+		}
+	}
+}
+#endif /* __IMAGE_COMPARE_H__ */
@@ -0,0 +1,65 @@
+#ifndef __MEDIA_H__
+#define __MEDIA_H__
+
+#include <string>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <climits>
+#endif
+
+namespace sb7 {
+	namespace media {
+		// Directory of the running executable, with a trailing separator.
+		std::string executable_dir() {
+			static std::string dir;
+			if (dir.empty()) {
+#ifdef _WIN32
+				char path[MAX_PATH];
+				DWORD len = GetModuleFileNameA(NULL, path, MAX_PATH);
+				dir.assign(path, len < MAX_PATH ? len : 0);
+#elif defined(__linux__)
+				char path[PATH_MAX];
+				ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+				dir.assign(path, len > 0 ? len : 0);
+#endif
+				size_t slash = dir.find_last_of("/\\");
+				dir = slash == std::string::npos ? std::string("./") : dir.substr(0, slash + 1);
+			}
+			return dir;
+		}
+
+		bool exists(const std::string & path) {
+			struct stat st;
+			return stat(path.c_str(), &st) == 0;
+		}
+
+		// Locates a file or directory under media/ without relying on the
+		// working directory: the media directory beside the executable's
+		// directory (the build tree layout) is tried first, then one next to
+		// the executable, then ../media relative to the working directory.
+		std::string path(const std::string & relative) {
+			const std::string candidates[] = {
+				executable_dir() + "../media/" + relative,
+				executable_dir() + "media/" + relative,
+				"../media/" + relative
+			};
+			for (int i = 0; i < 3; i++) {
+				if (exists(candidates[i]))
+					return candidates[i];
+			}
+			return candidates[2];
+		}
+
+		// Same for files produced by the build, such as the shader pack.
+		std::string build_path(const std::string & relative) {
+			const std::string candidates[] = {
+				executable_dir() + relative,
+				executable_dir() + "../" + relative
+			};
+			return exists(candidates[0]) || !exists(candidates[1]) ? candidates[0] : candidates[1];
+		}
+	}
+}
+#endif /* __MEDIA_H__ */
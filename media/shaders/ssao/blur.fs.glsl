@@ -0,0 +1,62 @@
+#version 430 core
+
+// Ambient occlusion and the normal and depth it was computed from
+layout (binding = 2) uniform sampler2D sAO;
+layout (binding = 3) uniform sampler2D sAONormalDepth;
+layout (binding = 9) uniform sampler2D sAODepthBuffer;
+
+// Blurred occlusion
+layout (location = 0) out float ao;
+
+// One direction per program: AXIS 0 blurs horizontally, 1 vertically
+#ifndef AXIS
+#define AXIS 0
+#endif
+
+#include "gbuffer.glsl"
+
+const int radius = 4;
+const float sigma = 2.0;
+
+// How quickly a neighbour's weight falls off with relative depth difference
+// and with the angle between the normals
+const float depth_sharpness = 32.0;
+const float normal_power = 8.0;
+
+// Separable bilateral blur: a Gaussian along one axis where every tap is
+// also weighted by how close its depth and normal are to the centre's, so
+// the sampling noise is smoothed out without leaking occlusion across
+// depth discontinuities or creases.
+void main(void)
+{
+    ivec2 P = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(sAO, 0);
+    vec4 ND = fetch_normal_depth(sAONormalDepth, sAODepthBuffer, P);
+    float sum = texelFetch(sAO, P, 0).r;
+    float total = 1.0;
+
+    // Nothing was drawn here
+    if (ND.w == 0.0)
+    {
+        ao = sum;
+        return;
+    }
+
+    for (int i = -radius; i <= radius; i++)
+    {
+        if (i == 0)
+            continue;
+
+        ivec2 Q = clamp(P + (AXIS == 0 ? ivec2(i, 0) : ivec2(0, i)), ivec2(0), size - 1);
+        vec4 q = fetch_normal_depth(sAONormalDepth, sAODepthBuffer, Q);
+
+        float w = exp(-float(i * i) / (2.0 * sigma * sigma));
+        w *= exp(-depth_sharpness * abs(q.w - ND.w) / ND.w);
+        w *= pow(max(dot(q.xyz, ND.xyz), 0.0), normal_power);
+
+        sum += texelFetch(sAO, Q, 0).r * w;
+        total += w;
+    }
+
+    ao = sum / total;
+}
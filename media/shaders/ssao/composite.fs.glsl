@@ -0,0 +1,89 @@
+#version 430 core
+
+// Samplers for pre-rendered color, normal and depth at full resolution
+layout (binding = 0) uniform sampler2D sColor;
+layout (binding = 1) uniform sampler2D sNormalDepth;
+layout (binding = 8) uniform sampler2D sDepthBuffer;
+
+// Ambient occlusion and the (possibly downsampled) normal and depth it was
+// computed from
+layout (binding = 2) uniform sampler2D sAO;
+layout (binding = 3) uniform sampler2D sAONormalDepth;
+layout (binding = 9) uniform sampler2D sAODepthBuffer;
+
+// Ratio of the full resolution to that of sAO
+#ifndef SCALE
+#define SCALE 1
+#endif
+
+// Final output
+layout (location = 0) out vec4 color;
+
+#include "gbuffer.glsl"
+
+// Joint bilateral upsampling: the four AO texels around this pixel are
+// blended with their bilinear weights, each scaled down the more its depth
+// and normal differ from the full resolution ones, so occlusion does not
+// bleed across silhouettes.
+float upsample_ao(vec2 P, vec3 N, float depth)
+{
+    ivec2 size = textureSize(sAO, 0);
+    vec2 t = P * vec2(size) - 0.5;
+    ivec2 base = ivec2(floor(t));
+    vec2 f = t - vec2(base);
+
+    float sum = 0.0;
+    float total = 0.0;
+    float nearest = 0.0;
+    float nearest_weight = -1.0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), size - 1);
+        vec4 ND = fetch_normal_depth(sAONormalDepth, sAODepthBuffer, texel);
+        float ao = texelFetch(sAO, texel, 0).r;
+
+        vec2 b = mix(1.0 - f, f, vec2(offset));
+        float depth_weight = 1.0 / (1e-3 + abs(ND.w - depth) / max(depth, 1e-3));
+        float normal_weight = pow(max(dot(ND.xyz, N), 0.0), 8.0);
+        float w = b.x * b.y * depth_weight * normal_weight;
+
+        sum += ao * w;
+        total += w;
+        if (depth_weight > nearest_weight)
+        {
+            nearest = ao;
+            nearest_weight = depth_weight;
+        }
+    }
+
+    // No texel matches (e.g. a surface only present at full resolution);
+    // fall back to the one closest in depth
+    return total > 1e-6 ? sum / total : nearest;
+}
+
+void main(void)
+{
+    // The passes before may have rendered at a lower resolution than the
+    // framebuffer
+    vec2 P = gl_FragCoord.xy * (frame.viewport_size / frame.output_size) / textureSize(sNormalDepth, 0);
+    float ao_amount;
+    if (SCALE == 1 && frame.viewport_size == frame.output_size)
+    {
+        ao_amount = texelFetch(sAO, ivec2(gl_FragCoord.xy), 0).r;
+    }
+    else
+    {
+        vec4 ND = sample_normal_depth(sNormalDepth, sDepthBuffer, P);
+        ao_amount = upsample_ao(P, ND.xyz, ND.w);
+    }
+
+    // Get object color from color texture, which is filtered; keep it from
+    // blending in the texels past the viewport
+    vec4 object_color = textureLod(sColor, min(P, (frame.viewport_size - 0.5) / textureSize(sColor, 0)), 0);
+
+    // Mix in ambient color scaled by SSAO level
+    color = ssao.object_level * object_color +
+            mix(vec4(0.2), vec4(ao_amount), ssao.ssao_level);
+}
@@ -0,0 +1,30 @@
+#version 430 core
+
+// Normal and depth at the occlusion resolution
+layout (binding = 1) uniform sampler2D sNormalDepth;
+layout (binding = 8) uniform sampler2D sDepthBuffer;
+
+#include "gbuffer.glsl"
+
+// Eight of the sixteen quarter resolution layers per pass; LAYER is the
+// first of them
+layout (location = 0) out vec4 normal_depth[8];
+
+#ifndef LAYER
+#define LAYER 0
+#endif
+
+// Layer l holds the pixel at (l % 4, l / 4) of every 4x4 block. The layers
+// are always RGBA32F, so a compact G-buffer is decoded here.
+void main(void)
+{
+    ivec2 base = ivec2(gl_FragCoord.xy) * 4;
+    ivec2 size = textureSize(sNormalDepth, 0);
+
+    for (int i = 0; i < 8; i++)
+    {
+        int l = LAYER + i;
+        ivec2 P = min(base + ivec2(l & 3, l >> 2), size - 1);
+        normal_depth[i] = fetch_normal_depth(sNormalDepth, sDepthBuffer, P);
+    }
+}
@@ -0,0 +1,29 @@
+#version 430 core
+
+// With FIRST_LEVEL the normal and depth the occlusion pass reads, otherwise
+// the linear depth pyramid with its base level set to the previous level
+#ifdef FIRST_LEVEL
+layout (binding = 1) uniform sampler2D sNormalDepth;
+layout (binding = 8) uniform sampler2D sDepthBuffer;
+
+#include "gbuffer.glsl"
+#else
+layout (binding = 4) uniform sampler2D sDepth;
+#endif
+
+layout (location = 0) out float depth;
+
+void main(void)
+{
+    ivec2 P = ivec2(gl_FragCoord.xy);
+
+#ifdef FIRST_LEVEL
+    depth = fetch_depth(sNormalDepth, sDepthBuffer, P);
+#else
+    // Take one real sample of each 2x2 block rather than an average, which
+    // would invent depths between surfaces. Alternating which one in a
+    // rotated grid keeps the coarser levels from drifting towards a corner.
+    ivec2 Q = P * 2 + ivec2(P.y & 1, P.x & 1);
+    depth = texelFetch(sDepth, clamp(Q, ivec2(0), textureSize(sDepth, 0) - 1), 0).r;
+#endif
+}
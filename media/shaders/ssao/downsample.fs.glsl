@@ -0,0 +1,60 @@
+#version 430 core
+
+// Full resolution normal and depth from the geometry pass
+layout (binding = 1) uniform sampler2D sNormalDepth;
+layout (binding = 8) uniform sampler2D sDepthBuffer;
+
+// One normal and depth per SCALE x SCALE block. With COMPACT_GBUFFER the
+// encoded normal and the depth buffer value of the chosen sample are
+// copied as they are, the depth through gl_FragDepth.
+layout (location = 0) out vec4 normal_depth;
+
+#ifndef SCALE
+#define SCALE 2
+#endif
+
+#include "gbuffer.glsl"
+
+// Background pixels have a depth of zero; treat them as infinitely far away
+float sort_depth(float depth)
+{
+    return depth > 0.0 ? depth : 1e30;
+}
+
+void main(void)
+{
+    ivec2 block = ivec2(gl_FragCoord.xy);
+    ivec2 base = block * SCALE;
+
+    // Picking a real sample rather than averaging keeps depth edges sharp.
+    // Alternating between the nearest and the farthest sample of each block
+    // in a checkerboard keeps both thin foreground features and the
+    // background behind them represented at the lower resolution.
+    bool nearest = ((block.x + block.y) & 1) == 0;
+
+    ivec2 best = base;
+    float best_depth = sort_depth(fetch_depth(sNormalDepth, sDepthBuffer, base));
+    for (int y = 0; y < SCALE; y++)
+    {
+        for (int x = 0; x < SCALE; x++)
+        {
+            float depth = sort_depth(fetch_depth(sNormalDepth, sDepthBuffer, base + ivec2(x, y)));
+            if (nearest ? depth < best_depth : depth > best_depth)
+            {
+                best = base + ivec2(x, y);
+                best_depth = depth;
+            }
+        }
+    }
+
+    // The target is cleared to zero, which is what a background block would
+    // write; discarding instead leaves the stencil marking only the blocks
+    // the occlusion pass has to shade
+    if (best_depth == 1e30)
+        discard;
+
+    normal_depth = texelFetch(sNormalDepth, best, 0);
+#ifdef COMPACT_GBUFFER
+    gl_FragDepth = texelFetch(sDepthBuffer, best, 0).r;
+#endif
+}
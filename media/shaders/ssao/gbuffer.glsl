@@ -0,0 +1,71 @@
+// Reading back the normal and linear depth render.fs.glsl writes, in
+// either G-buffer layout. By default both are in one RGBA32F texture. With
+// COMPACT_GBUFFER the texture only holds the octahedral encoded normal in
+// RG16 and the depth comes from the depth buffer, linearized with the
+// projection, so a depth tap reads 4 bytes rather than 16. Either way a
+// background pixel reads back a depth of 0.
+//
+// Every function takes both textures; depth_buffer is only sampled with
+// COMPACT_GBUFFER.
+
+#include "uniforms.glsl"
+
+vec2 oct_encode(vec3 n)
+{
+    n /= max(abs(n.x) + abs(n.y) + abs(n.z), 1e-6);
+    return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * sign(n.xy);
+}
+
+vec3 oct_decode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+    return normalize(n);
+}
+
+#ifdef COMPACT_GBUFFER
+// View space depth of a depth buffer value; the buffer is cleared to 1
+float linear_depth(float d)
+{
+    return d < 1.0 ? frame.proj_matrix[3][2] / (d * 2.0 - 1.0 + frame.proj_matrix[2][2]) : 0.0;
+}
+#endif
+
+vec4 fetch_normal_depth(sampler2D normal_depth, sampler2D depth_buffer, ivec2 P)
+{
+#ifdef COMPACT_GBUFFER
+    return vec4(oct_decode(texelFetch(normal_depth, P, 0).xy * 2.0 - 1.0),
+                linear_depth(texelFetch(depth_buffer, P, 0).r));
+#else
+    return texelFetch(normal_depth, P, 0);
+#endif
+}
+
+vec4 sample_normal_depth(sampler2D normal_depth, sampler2D depth_buffer, vec2 uv)
+{
+#ifdef COMPACT_GBUFFER
+    return vec4(oct_decode(textureLod(normal_depth, uv, 0).xy * 2.0 - 1.0),
+                linear_depth(textureLod(depth_buffer, uv, 0).r));
+#else
+    return textureLod(normal_depth, uv, 0);
+#endif
+}
+
+float fetch_depth(sampler2D normal_depth, sampler2D depth_buffer, ivec2 P)
+{
+#ifdef COMPACT_GBUFFER
+    return linear_depth(texelFetch(depth_buffer, P, 0).r);
+#else
+    return texelFetch(normal_depth, P, 0).w;
+#endif
+}
+
+float sample_depth(sampler2D normal_depth, sampler2D depth_buffer, vec2 uv)
+{
+#ifdef COMPACT_GBUFFER
+    return linear_depth(textureLod(depth_buffer, uv, 0).r);
+#else
+    return textureLod(normal_depth, uv, 0).w;
+#endif
+}
@@ -0,0 +1,136 @@
+// Horizon-based occlusion, the alternative to occlusion.glsl selected with
+// HORIZON. Declares the same occlusion(P, N, my_depth, v) and relies on the
+// same tap_depth(P, offset) from the including shader.
+//
+// Ground truth AO (Jimenez et al. 2016): the hemisphere is cut into
+// POINT_COUNT slices around the view vector. In each slice the highest
+// horizon on either side of the pixel is found by marching the depth, and
+// the cosine-weighted visible arc between the two horizons is integrated
+// analytically, so every tap narrows down the answer rather than adding
+// one more binary sample to an average.
+
+#ifdef POINT_COUNT
+#pragma optionNV(unroll all)
+#else
+#define POINT_COUNT ssao.point_count
+#endif
+#ifndef RANDOMIZE_POINTS
+#define RANDOMIZE_POINTS ssao.randomize_points
+#endif
+// Taps on each side of the pixel per slice
+#ifndef STEP_COUNT
+#define STEP_COUNT int(ssao.step_count)
+#endif
+
+#ifdef TEMPORAL
+#define POINT_OFFSET ssao.point_offset
+#else
+#define POINT_OFFSET 0u
+#endif
+
+// Screen space reach relative to ssao_radius; about as far as the point
+// marching goes with its default radius randomizer
+const float horizon_reach = 1.5;
+
+// Fraction of the reach over which a tap's horizon fades back to the
+// tangent plane, so distant occluders do not darken the pixel
+const float horizon_falloff = 0.6;
+
+const float PI = 3.14159265;
+
+// View space position of the pixel at P with linear depth depth. P is
+// relative to the whole G-buffer, not just the part the viewport covers.
+vec3 view_position(vec2 P, float depth)
+{
+    vec2 ndc = P * frame.target_size / frame.viewport_size * 2.0 - 1.0;
+    return vec3(ndc * depth / vec2(frame.proj_matrix[0][0], frame.proj_matrix[1][1]), -depth);
+}
+
+float occlusion(vec2 P, vec3 N, float my_depth, vec4 v)
+{
+    // Nothing was drawn here
+    if (my_depth == 0.0)
+        return 1.0;
+
+    vec3 pos = view_position(P, my_depth);
+    vec3 V = normalize(-pos);
+
+    // reach is in pixels, so screen directions map to view space directions
+    // one to one. radius is the reach in view space.
+    float reach = ssao.ssao_radius * horizon_reach;
+    float radius = reach * 2.0 / frame.viewport_size.x * my_depth / frame.proj_matrix[0][0];
+    float falloff_mul = -1.0 / (horizon_falloff * radius);
+    float falloff_add = 1.0 / horizon_falloff;
+
+    // Jitter where the taps start along a slice
+    float jitter = RANDOMIZE_POINTS != 0 ? v.r : 0.5;
+
+    float angle = float(POINT_OFFSET) * 2.3999632;
+#ifdef ROTATE_POINTS
+    angle += v.g * PI;
+#endif
+
+    float visibility = 0.0;
+
+    for (int i = 0; i < POINT_COUNT; i++)
+    {
+        float phi = angle + float(i) * PI / float(POINT_COUNT);
+        vec2 omega = vec2(cos(phi), sin(phi));
+
+        // The slice plane contains V and the slice direction; N projected
+        // into it gives the angle n the visible arc is centred on
+        vec3 direction = vec3(omega, 0.0);
+        vec3 ortho_direction = direction - dot(direction, V) * V;
+        vec3 axis = normalize(cross(direction, V));
+        vec3 projected_N = N - axis * dot(N, axis);
+        float projected_length = length(projected_N);
+        float cos_n = clamp(dot(projected_N, V) / max(projected_length, 1e-4), -1.0, 1.0);
+        float n = sign(dot(projected_N, ortho_direction)) * acos(cos_n);
+
+        // Start at the tangent plane on both sides
+        float low_cos0 = cos(n - 0.5 * PI);
+        float low_cos1 = cos(n + 0.5 * PI);
+        float horizon_cos0 = low_cos0;
+        float horizon_cos1 = low_cos1;
+
+        for (int j = 0; j < STEP_COUNT; j++)
+        {
+            // Denser near the pixel, where occluders matter most, but far
+            // enough out not to read the pixel itself
+            float s = (float(j) + jitter) / float(STEP_COUNT);
+            vec2 offset = omega * reach * mix(0.1, 1.0, s * s) / frame.target_size;
+
+            float depth0 = tap_depth(P, -offset);
+            float depth1 = tap_depth(P, offset);
+
+            // Background taps cannot occlude
+            if (depth0 != 0.0)
+            {
+                vec3 delta = view_position(P - offset, depth0) - pos;
+                float len = length(delta);
+                float c = mix(low_cos0, dot(delta, V) / len, clamp(len * falloff_mul + falloff_add, 0.0, 1.0));
+                horizon_cos0 = max(horizon_cos0, c);
+            }
+            if (depth1 != 0.0)
+            {
+                vec3 delta = view_position(P + offset, depth1) - pos;
+                float len = length(delta);
+                float c = mix(low_cos1, dot(delta, V) / len, clamp(len * falloff_mul + falloff_add, 0.0, 1.0));
+                horizon_cos1 = max(horizon_cos1, c);
+            }
+        }
+
+        // Horizon angles relative to V, clamped to the hemisphere around N
+        float h0 = -acos(clamp(horizon_cos0, -1.0, 1.0));
+        float h1 = acos(clamp(horizon_cos1, -1.0, 1.0));
+        h0 = n + clamp(h0 - n, -0.5 * PI, 0.5 * PI);
+        h1 = n + clamp(h1 - n, -0.5 * PI, 0.5 * PI);
+
+        // Cosine-weighted integral of the arc between them
+        float arc0 = (cos_n + 2.0 * h0 * sin(n) - cos(2.0 * h0 - n)) * 0.25;
+        float arc1 = (cos_n + 2.0 * h1 * sin(n) - cos(2.0 * h1 - n)) * 0.25;
+        visibility += projected_length * (arc0 + arc1);
+    }
+
+    return clamp(visibility / float(POINT_COUNT), 0.0, 1.0);
+}
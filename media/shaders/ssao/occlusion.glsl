@@ -0,0 +1,117 @@
+// The sample loop shared by ssao.fs.glsl and ssao.cs.glsl. The including
+// shader declares tap_depth(P, offset), which returns the depth at
+// P + offset, and includes uniforms.glsl first.
+
+// Specialized variants get these as compile-time constants (see
+// ssao_app::select_programs) so the sample loop has a fixed trip count
+// and can be fully unrolled; the generic program reads them from the
+// SSAO_PASS block.
+#ifdef POINT_COUNT
+#pragma optionNV(unroll all)
+#else
+#define POINT_COUNT ssao.point_count
+#endif
+#ifndef RANDOMIZE_POINTS
+#define RANDOMIZE_POINTS ssao.randomize_points
+#endif
+#ifndef WEIGHT_BY_ANGLE
+#define WEIGHT_BY_ANGLE ssao.weight_by_angle
+#endif
+#ifndef STEP_COUNT
+#define STEP_COUNT int(ssao.step_count)
+#endif
+
+// With TEMPORAL every frame takes the next POINT_COUNT points of the set
+// and turns them by another angle; temporal.fs.glsl accumulates the frames
+#ifdef TEMPORAL
+#define POINT_OFFSET ssao.point_offset
+#else
+#define POINT_OFFSET 0u
+#endif
+
+#include "sample_points.glsl"
+
+// Returns the ambient light reaching the surface at P with normal N and
+// depth my_depth; v is the random vector picked for it
+float occlusion(vec2 P, vec3 N, float my_depth, vec4 v)
+{
+    // Local temporary variables
+    int i;
+    int j;
+
+    float occ = 0.0;
+    float total = 0.0;
+
+    // r is our 'radius randomizer'
+    float r = (v.r + 3.0) * 0.1;
+    if (RANDOMIZE_POINTS == 0)
+        r = 0.5;
+    // Fewer, longer steps cover the same distance
+    r *= 4.0 / float(STEP_COUNT);
+
+    // The radius in texture coordinates
+    vec2 radius = ssao.ssao_radius / frame.target_size;
+
+#ifdef ROTATE_POINTS
+    // Turn the point set by a random angle around the view axis so that
+    // neighbouring pixels sample different directions; the blur that
+    // follows averages them into a smooth result
+    float angle = v.g * 6.2831853 + float(POINT_OFFSET) * 2.3999632;
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+#endif
+
+    // For each random point (or direction)...
+    for (i = 0; i < POINT_COUNT; i++)
+    {
+        // Get direction
+        vec3 dir = points.pos[(uint(i) + POINT_OFFSET) & 255u].xyz;
+#ifdef ROTATE_POINTS
+        dir.xy = rotation * dir.xy;
+#endif
+
+        // Put it into the correct hemisphere
+        float NdotD = dot(N, dir);
+        if (NdotD < 0.0)
+        {
+            dir = -dir;
+            NdotD = -NdotD;
+        }
+
+        // Directions close to the surface plane contribute less when
+        // weighting by angle
+        float w = WEIGHT_BY_ANGLE != 0 ? NdotD : 1.0;
+
+        // f is the distance we've stepped in this direction
+        // z is the interpolated depth
+        float f = 0.0;
+        float z = my_depth;
+
+        // We're going to take STEP_COUNT steps
+        total += float(STEP_COUNT) * w;
+
+        for (j = 0; j < STEP_COUNT; j++)
+        {
+            // Step in the right direction
+            f += r;
+            // Step _towards_ viewer reduces z
+            z -= dir.z * f;
+
+            // Read depth from current fragment
+            float their_depth = tap_depth(P, dir.xy * f * radius);
+
+            // Calculate a weighting (d) for this fragment's
+            // contribution to occlusion
+            float d = abs(their_depth - my_depth);
+            d *= d;
+
+            // If we're obscured, accumulate occlusion
+            if ((z - their_depth) > 0.0)
+            {
+                occ += w * 4.0 / (1.0 + d);
+            }
+        }
+    }
+
+    // Calculate occlusion amount
+    return 1.0 - occ / max(total, 1e-4);
+}
@@ -0,0 +1,13 @@
+#version 430 core
+
+// Occlusion of each of the sixteen quarter resolution layers
+layout (binding = 2) uniform sampler2DArray sAOLayers;
+
+layout (location = 0) out float ao;
+
+// Puts every pixel back where deinterleave.fs.glsl took it from
+void main(void)
+{
+    ivec2 P = ivec2(gl_FragCoord.xy);
+    ao = texelFetch(sAOLayers, ivec3(P >> 2, (P.x & 3) + (P.y & 3) * 4), 0).r;
+}
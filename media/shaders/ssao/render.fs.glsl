@@ -1,8 +1,10 @@
-#version 410 core
+#version 430 core
 
 // Output
 layout (location = 0) out vec4 color;
-layout (location = 1) out vec4 normal_depth;
+layout (location = 1) out vec4 normal_depth;    // normal only with COMPACT_GBUFFER
+// Motion since the previous frame in pixels and the depth it had then
+layout (location = 2) out vec4 motion;
 
 // Input from vertex shader
 in VS_OUT
@@ -10,13 +12,15 @@ in VS_OUT
     vec3 N;
     vec3 L;
     vec3 V;
+    vec4 prev_position;
 } fs_in;
 
 // Material properties
-uniform vec3 diffuse_albedo = vec3(0.8, 0.8, 0.9);
-uniform vec3 specular_albedo = vec3(0.01);
-uniform float specular_power = 128.0;
-uniform float shading_level = 1.0;
+const vec3 diffuse_albedo = vec3(0.8, 0.8, 0.9);
+const vec3 specular_albedo = vec3(0.01);
+const float specular_power = 128.0;
+
+#include "gbuffer.glsl"
 
 void main(void)
 {
@@ -34,6 +38,14 @@ void main(void)
     vec3 specular = pow(max(dot(R, V), 0.0), specular_power) * specular_albedo;
 
     // Write final color to the framebuffer
-    color = mix(vec4(0.0), vec4(diffuse + specular, 1.0), shading_level);
+    color = mix(vec4(0.0), vec4(diffuse + specular, 1.0), geometry.shading_level);
+#ifdef COMPACT_GBUFFER
+    normal_depth = vec4(oct_encode(N) * 0.5 + 0.5, 0.0, 0.0);
+#else
     normal_depth = vec4(N, fs_in.V.z);
+#endif
+
+    // w of a perspective projection is the view space depth
+    vec2 prev_pixel = (fs_in.prev_position.xy / fs_in.prev_position.w * 0.5 + 0.5) * frame.viewport_size;
+    motion = vec4(gl_FragCoord.xy - prev_pixel, fs_in.prev_position.w, 0.0);
 }
@@ -1,11 +1,10 @@
-#version 410 core
+#version 430 core
 
 // Per-vertex inputs
 layout (location = 0) in vec4 position;
 layout (location = 1) in vec3 normal;
 
-uniform mat4 mv_matrix;
-uniform mat4 proj_matrix;
+#include "uniforms.glsl"
 
 // Inputs from vertex shader
 out VS_OUT
@@ -13,18 +12,19 @@ out VS_OUT
     vec3 N;
     vec3 L;
     vec3 V;
+    vec4 prev_position;         // clip space position in the previous frame
 } vs_out;
 
 // Position of light
-uniform vec3 light_pos = vec3(100.0, 100.0, 100.0);
+const vec3 light_pos = vec3(100.0, 100.0, 100.0);
 
 void main(void)
 {
     // Calculate view-space coordinate
-    vec4 P = mv_matrix * position;
+    vec4 P = object.mv_matrix * position;
 
     // Calculate normal in view-space
-    vs_out.N = mat3(mv_matrix) * normal;
+    vs_out.N = mat3(object.mv_matrix) * normal;
 
     // Calculate light vector
     vs_out.L = light_pos - P.xyz;
@@ -33,5 +33,6 @@ void main(void)
     vs_out.V = -P.xyz;
 
     // Calculate the clip-space position of each vertex
-    gl_Position = proj_matrix * P;
+    gl_Position = frame.proj_matrix * P;
+    vs_out.prev_position = frame.prev_proj_matrix * object.prev_mv_matrix * position;
 }
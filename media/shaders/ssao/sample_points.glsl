@@ -0,0 +1,7 @@
+// Uniform block containing up to 256 random directions (x,y,z,0)
+// and 256 more completely random vectors
+layout (binding = 0, std140) uniform SAMPLE_POINTS
+{
+    vec4 pos[256];
+    vec4 random_vectors[256];
+} points;
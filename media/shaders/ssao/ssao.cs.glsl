@@ -0,0 +1,83 @@
+#version 430 core
+
+// The occlusion pass as a compute shader. Each workgroup first copies the
+// depth of its tile of pixels, plus an apron around it, into shared
+// memory. APRON comes from ssao_app::compute_apron: with LDS_ONLY it
+// covers the farthest tap the radius allows and every tap reads shared
+// memory; otherwise the tile would not fit, and taps beyond the apron
+// read the texture. Writes the same occlusion ssao.fs.glsl does with
+// AO_ONLY.
+
+#define TILE 16
+#ifndef APRON
+#define APRON 16
+#endif
+
+layout (local_size_x = TILE, local_size_y = TILE) in;
+
+// Normal and depth at the occlusion resolution
+layout (binding = 1) uniform sampler2D sNormalDepth;
+layout (binding = 8) uniform sampler2D sDepthBuffer;
+
+// Random vectors tiled over the screen, see ssao_app::create_sample_points
+layout (binding = 7) uniform sampler2D sNoise;
+
+// Occlusion output
+layout (binding = 0, r8) writeonly uniform image2D ao_image;
+
+#include "gbuffer.glsl"
+
+const int tile_size = TILE + 2 * APRON;
+
+shared float tile_depth[tile_size * tile_size];
+
+// Texel at the top left of tile_depth
+ivec2 tile_origin;
+
+float tap_depth(vec2 P, vec2 offset)
+{
+    ivec2 t = ivec2(floor((P + offset) * textureSize(sNormalDepth, 0))) - tile_origin;
+#ifdef LDS_ONLY
+    // The apron covers every tap; the clamp only guards against rounding
+    t = clamp(t, ivec2(0), ivec2(tile_size - 1));
+    return tile_depth[t.y * tile_size + t.x];
+#else
+    if (all(greaterThanEqual(t, ivec2(0))) && all(lessThan(t, ivec2(tile_size))))
+        return tile_depth[t.y * tile_size + t.x];
+    return sample_depth(sNormalDepth, sDepthBuffer, P + offset);
+#endif
+}
+
+#include "sample_points.glsl"
+
+// HORIZON picks the horizon-based technique over point marching
+#ifdef HORIZON
+#include "horizon.glsl"
+#else
+#include "occlusion.glsl"
+#endif
+
+void main(void)
+{
+    ivec2 size = textureSize(sNormalDepth, 0);
+    tile_origin = ivec2(gl_WorkGroupID.xy) * TILE - APRON;
+
+    // Going through the sampler keeps its wrap mode for texels off the edge
+    for (uint i = gl_LocalInvocationIndex; i < uint(tile_size * tile_size); i += uint(TILE * TILE))
+    {
+        ivec2 t = ivec2(int(i) % tile_size, int(i) / tile_size);
+        tile_depth[i] = sample_depth(sNormalDepth, sDepthBuffer, (vec2(tile_origin + t) + 0.5) / vec2(size));
+    }
+    barrier();
+
+    // Same position and random vector the fragment shader would use
+    vec2 frag_coord = vec2(gl_GlobalInvocationID.xy) + 0.5;
+    vec2 P = frag_coord / vec2(size);
+    vec4 ND = fetch_normal_depth(sNormalDepth, sDepthBuffer, ivec2(gl_GlobalInvocationID.xy));
+
+    vec4 v = vec4(texelFetch(sNoise, ivec2(gl_GlobalInvocationID.xy) & (textureSize(sNoise, 0) - 1), 0).rg, 0.0, 0.0);
+
+    // Background pixels are unoccluded
+    float ao = ND.w != 0.0 ? occlusion(P, ND.xyz, ND.w, v) : 1.0;
+    imageStore(ao_image, ivec2(gl_GlobalInvocationID.xy), vec4(ao));
+}
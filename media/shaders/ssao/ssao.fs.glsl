@@ -1,110 +1,117 @@
 #version 430 core
 
-// Samplers for pre-rendered color, normal and depth
+// Samplers for pre-rendered color, normal and depth. When AO_ONLY is
+// defined sNormalDepth may be a downsampled copy of the G-buffer and only
+// the occlusion term is written; composite.fs.glsl applies it. sDepthBuffer
+// is the matching depth buffer, only read with COMPACT_GBUFFER.
 layout (binding = 0) uniform sampler2D sColor;
+#ifdef DEINTERLEAVED
+// One quarter resolution layer of the normal and depth at a time, see
+// deinterleave.fs.glsl; the AO_LAYER block says which
+layout (binding = 1) uniform sampler2DArray sNormalDepth;
+#define NORMAL_DEPTH(uv) textureLod(sNormalDepth, vec3(uv, layer.index), 0)
+#else
 layout (binding = 1) uniform sampler2D sNormalDepth;
+layout (binding = 8) uniform sampler2D sDepthBuffer;
+#define NORMAL_DEPTH(uv) sample_normal_depth(sNormalDepth, sDepthBuffer, uv)
+#endif
+
+// With DEPTH_MIPS (the number of levels) taps read depth from a linear
+// depth pyramid instead, see depth_mip.fs.glsl
+#ifdef DEPTH_MIPS
+layout (binding = 4) uniform sampler2D sDepth;
+
+// Taps up to 2^log_max_offset texels away read the full resolution level
+const float log_max_offset = 3.0;
+#endif
+
+// Random vectors tiled over the screen, see ssao_app::create_sample_points
+layout (binding = 7) uniform sampler2D sNoise;
 
 // Final output
+#ifdef AO_ONLY
+layout (location = 0) out float ao;
+#else
 layout (location = 0) out vec4 color;
+#endif
 
-// Various uniforms controling SSAO effect
-uniform float ssao_level = 1.0;
-uniform float object_level = 1.0;
-uniform float ssao_radius = 5.0;
-uniform bool weight_by_angle = true;
-uniform uint point_count = 8;
-uniform bool randomize_points = true;
+#include "gbuffer.glsl"
 
-// Uniform block containing up to 256 random directions (x,y,z,0)
-// and 256 more completely random vectors
-layout (binding = 0, std140) uniform SAMPLE_POINTS
+float tap_depth(vec2 P, vec2 offset)
 {
-    vec4 pos[256];
-    vec4 random_vectors[256];
-} points;
+#ifdef DEPTH_MIPS
+    // Farther taps read coarser levels, so neighbouring pixels' taps keep
+    // hitting the same cache lines however wide the radius is
+    float lod = clamp(floor(log2(length(offset * textureSize(sDepth, 0)))) - log_max_offset,
+                      0.0, float(DEPTH_MIPS - 1));
+    return textureLod(sDepth, P + offset, lod).r;
+#elif defined(DEINTERLEAVED)
+    return NORMAL_DEPTH(P + offset).w;
+#else
+    return sample_depth(sNormalDepth, sDepthBuffer, P + offset);
+#endif
+}
+
+#include "sample_points.glsl"
+
+// HORIZON picks the horizon-based technique over point marching
+#ifdef HORIZON
+#include "horizon.glsl"
+#else
+#include "occlusion.glsl"
+#endif
 
 void main(void)
 {
     // Get texture position from gl_FragCoord
+#ifdef DEINTERLEAVED
+    // The position of the full resolution pixel this layer texel holds
+    vec2 P = (floor(gl_FragCoord.xy) * 4.0 + vec2(layer.offset) + 0.5) /
+             (4.0 * vec2(textureSize(sNormalDepth, 0).xy));
+#else
     vec2 P = gl_FragCoord.xy / textureSize(sNormalDepth, 0);
+#ifndef AO_ONLY
+    // Drawn straight into the framebuffer, which the G-buffer may be
+    // scaled down from
+    P *= frame.viewport_size / frame.output_size;
+#endif
+#endif
     // ND = normal and depth
-    vec4 ND = textureLod(sNormalDepth, P, 0);
+    vec4 ND = NORMAL_DEPTH(P);
     // Extract normal and depth
     vec3 N = ND.xyz;
     float my_depth = ND.w;
 
-    // Local temporary variables
-    int i;
-    int j;
-    int n;
-
-    float occ = 0.0;
-    float total = 0.0;
-
-    // n is a pseudo-random number generated from fragment coordinate
-    // and depth
-    n = (int(gl_FragCoord.x * 7123.2315 + 125.232) *
-         int(gl_FragCoord.y * 3137.1519 + 234.8)) ^
-         int(my_depth);
-    // Pull one of the random vectors
-    vec4 v = points.random_vectors[n & 255];
-
-    // r is our 'radius randomizer'
-    float r = (v.r + 3.0) * 0.1;
-    if (!randomize_points)
-        r = 0.5;
-
-    // For each random point (or direction)...
-    for (i = 0; i < point_count; i++)
-    {
-        // Get direction
-        vec3 dir = points.pos[i].xyz;
-
-        // Put it into the correct hemisphere
-        if (dot(N, dir) < 0.0)
-            dir = -dir;
-
-        // f is the distance we've stepped in this direction
-        // z is the interpolated depth
-        float f = 0.0;
-        float z = my_depth;
-
-        // We're going to take 4 steps - we could make this
-        // configurable
-        total += 4.0;
-
-        for (j = 0; j < 4; j++)
-        {
-            // Step in the right direction
-            f += r;
-            // Step _towards_ viewer reduces z
-            z -= dir.z * f;
-
-            // Read depth from current fragment
-            float their_depth =
-                textureLod(sNormalDepth,
-                           (P + dir.xy * f * ssao_radius), 0).w;
-
-            // Calculate a weighting (d) for this fragment's
-            // contribution to occlusion
-            float d = abs(their_depth - my_depth);
-            d *= d;
-
-            // If we're obscured, accumulate occlusion
-            if ((z - their_depth) > 0.0)
-            {
-                occ += 4.0 / (1.0 + d);
-            }
-        }
-    }
-
-    // Calculate occlusion amount
-    float ao_amount = (1.0 - occ / total);
-
+#ifdef DEINTERLEAVED
+    // Every pixel of a layer uses the same random vector, so neighbouring
+    // texels take neighbouring taps
+    vec4 v = points.random_vectors[layer.index];
+#else
+    // Pull the random vector for this pixel from the tiled noise; the size
+    // is a power of two so the wrap is a mask
+    vec4 v = vec4(texelFetch(sNoise, ivec2(gl_FragCoord.xy) & (textureSize(sNoise, 0) - 1), 0).rg, 0.0, 0.0);
+#endif
+
+    // Background pixels are unoccluded. Except with compute, the stencil
+    // keeps this shader off them; with BACKGROUND_ONLY it shades just them,
+    // and clears their stencil for the pass proper, see
+    // ssao_app::draw_single_pass and ssao_app::render_ao_layers.
+#ifdef BACKGROUND_ONLY
+    if (my_depth != 0.0)
+        discard;
+    float ao_amount = 1.0;
+#else
+    float ao_amount = my_depth != 0.0 ? occlusion(P, N, my_depth, v) : 1.0;
+#endif
+
+#ifdef AO_ONLY
+    ao = ao_amount;
+#else
     // Get object color from color texture
     vec4 object_color =  textureLod(sColor, P, 0);
 
     // Mix in ambient color scaled by SSAO level
-    color = object_level * object_color +
-            mix(vec4(0.2), vec4(ao_amount), ssao_level);
+    color = ssao.object_level * object_color +
+            mix(vec4(0.2), vec4(ao_amount), ssao.ssao_level);
+#endif
 }
@@ -0,0 +1,54 @@
+#version 430 core
+
+// This frame's occlusion and the normal and depth it was computed from
+layout (binding = 2) uniform sampler2D sAO;
+layout (binding = 3) uniform sampler2D sAONormalDepth;
+layout (binding = 9) uniform sampler2D sAODepthBuffer;
+
+// Full resolution motion from the geometry pass
+layout (binding = 5) uniform sampler2D sMotion;
+
+// Accumulated occlusion of the previous frame
+layout (binding = 6) uniform sampler2D sHistory;
+
+// Accumulated occlusion, depth and octahedral normal
+layout (location = 0) out vec4 history;
+
+#include "gbuffer.glsl"
+
+// Ratio of the full resolution to that of sAO
+#ifndef SCALE
+#define SCALE 1
+#endif
+
+// Reprojected history is dropped when its depth is further than this
+// fraction from the depth the surface had last frame, or its normal turned
+// by more than about 35 degrees
+const float depth_tolerance = 0.05;
+const float normal_tolerance = 0.8;
+
+// Blends this frame's occlusion into the history at the position the
+// surface had in the previous frame. Where it was not visible then the
+// history restarts from this frame.
+void main(void)
+{
+    ivec2 P = ivec2(gl_FragCoord.xy);
+    vec4 ND = fetch_normal_depth(sAONormalDepth, sAODepthBuffer, P);
+    float ao = texelFetch(sAO, P, 0).r;
+
+    history = vec4(ao, ND.w, oct_encode(ND.xyz));
+    if (ND.w == 0.0 || ssao.history_weight == 0.0)
+        return;
+
+    vec4 motion = texelFetch(sMotion, P * SCALE, 0);
+    vec2 prev = gl_FragCoord.xy - motion.xy / float(SCALE);
+    if (any(lessThan(prev, vec2(0.0))) || any(greaterThanEqual(prev, ceil(frame.viewport_size / float(SCALE)))))
+        return;
+
+    vec4 h = texelFetch(sHistory, ivec2(prev), 0);
+    if (abs(h.y - motion.z) > depth_tolerance * motion.z ||
+        dot(oct_decode(h.zw), ND.xyz) < normal_tolerance)
+        return;
+
+    history.x = mix(ao, h.x, ssao.history_weight);
+}
@@ -0,0 +1,47 @@
+// Uniform blocks streamed by the application every frame. The layouts must
+// match the structs of the same name in ssao.cpp; ssao_app checks them
+// against each program it links.
+
+// Constant for the whole frame
+layout (binding = 1, std140) uniform FRAME
+{
+    mat4 proj_matrix;
+    mat4 prev_proj_matrix;      // of the previous frame
+    vec2 viewport_size;         // in pixels, of the geometry and occlusion passes
+    vec2 target_size;           // of the G-buffer, which the viewport covers part of
+    vec2 output_size;           // of the framebuffer the viewport is scaled up to
+} frame;
+
+// Settings of the geometry pass
+layout (binding = 2, std140) uniform GEOMETRY_PASS
+{
+    float shading_level;
+} geometry;
+
+// Per object drawn in the geometry pass
+layout (binding = 3, std140) uniform OBJECT
+{
+    mat4 mv_matrix;
+    mat4 prev_mv_matrix;        // of the previous frame
+} object;
+
+// Settings of the SSAO pass
+layout (binding = 4, std140) uniform SSAO_PASS
+{
+    float ssao_level;
+    float object_level;
+    float ssao_radius;          // in G-buffer pixels
+    uint  point_count;
+    int   randomize_points;
+    int   weight_by_angle;
+    uint  point_offset;         // first of the points used this frame
+    float history_weight;       // of the accumulated occlusion, 0 to reset
+    uint  step_count;           // along each point or slice
+} ssao;
+
+// Per layer drawn by the deinterleaved occlusion pass
+layout (binding = 5, std140) uniform AO_LAYER
+{
+    ivec2 offset;   // of the layer's pixel within each 4x4 block
+    int   index;
+} layer;
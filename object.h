@@ -39,6 +39,10 @@ namespace sb7 {
 			size_t filesize;
 			char * data;
 			this->free();
+			if (!infile) {
+				fprintf(stderr, "%s: unable to open\n", filename);
+				return;
+			}
 			fseek(infile, 0, SEEK_END);
 			filesize = ftell(infile);
 			fseek(infile, 0, SEEK_SET);
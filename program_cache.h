@@ -0,0 +1,294 @@
+#ifndef __PROGRAM_CACHE_H__
+#define __PROGRAM_CACHE_H__
+
+#include <map>
+#include <set>
+#include <string>
+#include "shader.h"
+#include "shaderpack.h"
+#include "media.h"
+#include "file_watcher.h"
+#include "program_reflection.h"
+
+namespace sb7 {
+	// Keeps one linked program per (vertex shader, fragment shader, defines)
+	// or (compute shader, defines) permutation. A variant is built the first
+	// time it is requested and handed out from the cache afterwards, so
+	// switching between specialized programs at draw time costs a map
+	// lookup.
+	//
+	// Builds never block the caller. With KHR_parallel_shader_compile every
+	// compile and link is submitted at once and update() polls
+	// GL_COMPLETION_STATUS_KHR; without it update() advances the pending
+	// builds by a single compile or link per call. Until a build has
+	// finished get() keeps returning the previously linked program (0 for a
+	// permutation that has never linked), so a reload never stalls a frame.
+	//
+	// Every source file a program was built from, includes too, is watched;
+	// when one changes on disk only the programs using it are rebuilt, one
+	// submission per update() so that editing a shared include does not
+	// queue all permutations in the same frame.
+	//
+	// Freshly linked programs are checked against the uniform block layouts
+	// registered with expect_block(), see program::validate().
+	//
+	// Shader names are looked up in the shader pack given to set_sources()
+	// and otherwise read from the source directory. Once a source file in
+	// that directory changes, it overrides the packed copy from then on.
+	class program_cache : private shader::source_loader {
+	public:
+		program_cache() : watch_sources(true), initialized(false), parallel(false) {}
+		~program_cache() {}
+
+		void set_sources(const std::string & pack_filename, const std::string & source_dir) {
+			pack.open(pack_filename.c_str());
+			directory = source_dir;
+			// A deployment that only ships the pack has nothing to watch
+			watch_sources = !directory.empty() && media::exists(directory);
+		}
+
+		GLuint get(const char * vs_filename, const char * fs_filename, const char * defines = "") {
+			std::string key = std::string(vs_filename) + '|' + fs_filename + '|' + defines;
+			std::map<std::string, entry>::iterator it = entries.find(key);
+			if (it != entries.end())
+				return it->second.program;
+
+			entry & e = entries[key];
+			e.files[0] = vs_filename;
+			e.files[1] = fs_filename;
+			e.defines = defines;
+			submit(e);
+			return e.program;
+		}
+
+		// Compute programs are kept as a pair without a vertex shader
+		GLuint get_compute(const char * cs_filename, const char * defines = "") {
+			return get("", cs_filename, defines);
+		}
+
+		// Picks up changed sources and polls the pending builds; call once
+		// per frame.
+		void update() {
+			std::map<std::string, entry>::iterator it;
+			changed.clear();
+			if (watcher.poll(changed)) {
+				for (size_t i = 0; i < changed.size(); i++) {
+					fprintf(stderr, "%s changed, rebuilding dependent programs\n", changed[i].c_str());
+					std::string name = changed[i].substr(directory.size());
+					overrides.insert(name);
+					for (it = entries.begin(); it != entries.end(); ++it) {
+						const std::vector<std::string> & deps = it->second.dependencies;
+						for (size_t j = 0; j < deps.size(); j++)
+							it->second.dirty |= deps[j] == name;
+					}
+				}
+			}
+			for (it = entries.begin(); it != entries.end(); ++it) {
+				if (it->second.dirty) {
+					submit(it->second);
+					break;
+				}
+			}
+
+			bool stepped = false;
+			for (it = entries.begin(); it != entries.end(); ++it) {
+				entry & e = it->second;
+				if (e.step == STEP_IDLE)
+					continue;
+				if (parallel) {
+					GLint done = GL_FALSE;
+					glGetProgramiv(e.pending, GL_COMPLETION_STATUS_KHR, &done);
+					if (done)
+						complete(e);
+				} else if (!stepped) {
+					advance(e);
+					stepped = true;
+				}
+			}
+		}
+
+		// Blocks until every pending build has finished. Only meant for
+		// startup, where there is no previous program to fall back to.
+		void finish() {
+			std::map<std::string, entry>::iterator it;
+			for (it = entries.begin(); it != entries.end(); ++it) {
+				while (it->second.step != STEP_IDLE)
+					advance(it->second);
+			}
+		}
+
+		// Rebuilds every cached permutation from source in the background.
+		void reload() {
+			std::map<std::string, entry>::iterator it;
+			for (it = entries.begin(); it != entries.end(); ++it)
+				it->second.dirty = true;
+		}
+
+		bool busy() const {
+			std::map<std::string, entry>::const_iterator it;
+			for (it = entries.begin(); it != entries.end(); ++it) {
+				if (it->second.dirty || it->second.step != STEP_IDLE)
+					return true;
+			}
+			return false;
+		}
+
+		void clear() {
+			std::map<std::string, entry>::iterator it;
+			for (it = entries.begin(); it != entries.end(); ++it) {
+				cancel(it->second);
+				if (it->second.program)
+					glDeleteProgram(it->second.program);
+			}
+			entries.clear();
+		}
+
+		size_t size() const {
+			return entries.size();
+		}
+
+		void expect_block(const char * name, GLuint binding, GLsizeiptr size) {
+			program::block_layout layout = { name, binding, size };
+			blocks.push_back(layout);
+		}
+
+	private:
+		enum {
+			STEP_IDLE,
+			STEP_COMPILE_VS,
+			STEP_COMPILE_FS,
+			STEP_LINK,
+			STEP_CHECK
+		};
+
+		struct entry {
+			entry() : program(0), pending(0), step(STEP_IDLE), dirty(false) {
+				shaders[0] = shaders[1] = 0;
+			}
+			std::string files[2];
+			std::string defines;
+			std::vector<std::string> dependencies;
+			GLuint      program;
+			GLuint      pending;
+			GLuint      shaders[2];
+			int         step;
+			bool        dirty;
+		};
+
+		void submit(entry & e) {
+			const GLenum types[2] = { GL_VERTEX_SHADER, GLenum(e.files[0].empty() ? GL_COMPUTE_SHADER : GL_FRAGMENT_SHADER) };
+			if (!initialized) {
+				parallel = program::enable_parallel_compile();
+				initialized = true;
+			}
+			cancel(e);
+			e.dirty = false;
+			e.dependencies.clear();
+			for (int i = e.files[0].empty() ? 1 : 0; i < 2; i++) {
+				std::string source;
+				std::vector<std::string> files;
+				bool ok = shader::preprocess(e.files[i].c_str(), e.defines.c_str(), source, files, this);
+				for (size_t j = 0; j < files.size(); j++) {
+					e.dependencies.push_back(files[j]);
+					if (watch_sources)
+						watcher.watch(directory + files[j]);
+				}
+				if (!ok) {
+					cancel(e);
+					return;
+				}
+				const char * data = source.c_str();
+				e.shaders[i] = glCreateShader(types[i]);
+				glShaderSource(e.shaders[i], 1, &data, NULL);
+			}
+			e.pending = glCreateProgram();
+			e.step = e.shaders[0] ? STEP_COMPILE_VS : STEP_COMPILE_FS;
+			if (parallel) {
+				// Everything is queued up front; the driver works on it while
+				// we keep rendering and update() polls for completion
+				while (e.step != STEP_CHECK)
+					advance(e);
+			}
+		}
+
+		void advance(entry & e) {
+			switch (e.step) {
+			case STEP_COMPILE_VS:
+				glCompileShader(e.shaders[0]);
+				e.step = STEP_COMPILE_FS;
+				break;
+			case STEP_COMPILE_FS:
+				glCompileShader(e.shaders[1]);
+				e.step = STEP_LINK;
+				break;
+			case STEP_LINK:
+				if (e.shaders[0])
+					glAttachShader(e.pending, e.shaders[0]);
+				glAttachShader(e.pending, e.shaders[1]);
+				glLinkProgram(e.pending);
+				e.step = STEP_CHECK;
+				break;
+			case STEP_CHECK:
+				complete(e);
+				break;
+			default:
+				break;
+			}
+		}
+
+		void complete(entry & e) {
+			GLint status = GL_FALSE;
+			glGetProgramiv(e.pending, GL_LINK_STATUS, &status);
+			if (status) {
+				// Swap in the new program; the old one is no longer referenced
+				if (e.program)
+					glDeleteProgram(e.program);
+				e.program = e.pending;
+				e.pending = 0;
+				program::validate(e.program, e.files[1].c_str(), blocks);
+			} else {
+				// Keep using the last good program so a typo during live
+				// editing does not take the pass down
+				int first = e.shaders[0] ? 0 : 1;
+				program::print_errors(e.pending, e.shaders + first, 2 - first, e.files[1].c_str());
+			}
+			cancel(e);
+		}
+
+		bool read(const std::string & name, std::string & text) {
+			if (pack.is_open() && !overrides.count(name)) {
+				size_t length = 0;
+				const char * data = pack.find(name, &length);
+				if (data) {
+					text.assign(data, length);
+					return true;
+				}
+			}
+			return shader::read_file((directory + name).c_str(), text);
+		}
+
+		void cancel(entry & e) {
+			for (int i = 0; i < 2; i++) {
+				if (e.shaders[i])
+					glDeleteShader(e.shaders[i]);
+				e.shaders[i] = 0;
+			}
+			if (e.pending)
+				glDeleteProgram(e.pending);
+			e.pending = 0;
+			e.step = STEP_IDLE;
+		}
+
+		std::map<std::string, entry> entries;
+		shader_pack pack;
+		std::string directory;
+		std::set<std::string> overrides;
+		file_watcher watcher;
+		std::vector<std::string> changed;
+		std::vector<program::block_layout> blocks;
+		bool watch_sources;
+		bool initialized;
+		bool parallel;
+	};
+}
+#endif /* __PROGRAM_CACHE_H__ */
@@ -0,0 +1,115 @@
+#ifndef __PROGRAM_REFLECTION_H__
+#define __PROGRAM_REFLECTION_H__
+
+#include <string>
+#include <vector>
+#include "shader.h"
+
+namespace sb7 {
+	namespace program {
+		struct uniform_info {
+			std::string name;
+			GLenum      type;
+			GLint       location;
+			GLint       block_index;
+		};
+
+		struct block_info {
+			std::string name;
+			GLint       binding;
+			GLint       data_size;
+		};
+
+		// The layout an application expects for a uniform block: the binding
+		// it streams the block to and sizeof() of the matching C++ struct.
+		struct block_layout {
+			const char * name;
+			GLuint       binding;
+			GLsizeiptr   size;
+		};
+
+		// Samplers, images and atomic counters are configured by layout
+		// qualifiers in the shader rather than by the application.
+		bool is_opaque_type(GLenum type) {
+			return (type >= GL_SAMPLER_1D && type <= GL_SAMPLER_2D_RECT_SHADOW) ||
+				   (type >= GL_SAMPLER_1D_ARRAY && type <= GL_UNSIGNED_INT_SAMPLER_BUFFER &&
+					!(type >= GL_UNSIGNED_INT_VEC2 && type <= GL_UNSIGNED_INT_VEC4)) ||
+				   (type >= GL_SAMPLER_CUBE_MAP_ARRAY && type <= GL_UNSIGNED_INT_SAMPLER_CUBE_MAP_ARRAY) ||
+				   (type >= GL_SAMPLER_2D_MULTISAMPLE && type <= GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY) ||
+				   (type >= GL_IMAGE_1D && type <= GL_UNSIGNED_INT_IMAGE_2D_MULTISAMPLE_ARRAY) ||
+				   type == GL_UNSIGNED_INT_ATOMIC_COUNTER;
+		}
+
+		// Lists the active uniforms and uniform blocks of a linked program.
+		void reflect(GLuint program, std::vector<uniform_info> & uniforms, std::vector<block_info> & blocks) {
+			static const GLenum uniform_props[] = { GL_NAME_LENGTH, GL_TYPE, GL_LOCATION, GL_BLOCK_INDEX };
+			static const GLenum block_props[] = { GL_NAME_LENGTH, GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+			GLint values[4];
+			GLint count = 0;
+			char name[256];
+
+			uniforms.clear();
+			glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+			for (GLint i = 0; i < count; i++) {
+				glGetProgramResourceiv(program, GL_UNIFORM, i, 4, uniform_props, 4, NULL, values);
+				glGetProgramResourceName(program, GL_UNIFORM, i, sizeof(name), NULL, name);
+				uniform_info u;
+				u.name = name;
+				u.type = (GLenum)values[1];
+				u.location = values[2];
+				u.block_index = values[3];
+				uniforms.push_back(u);
+			}
+
+			blocks.clear();
+			count = 0;
+			glGetProgramInterfaceiv(program, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &count);
+			for (GLint i = 0; i < count; i++) {
+				glGetProgramResourceiv(program, GL_UNIFORM_BLOCK, i, 3, block_props, 3, NULL, values);
+				glGetProgramResourceName(program, GL_UNIFORM_BLOCK, i, sizeof(name), NULL, name);
+				block_info b;
+				b.name = name;
+				b.binding = values[1];
+				b.data_size = values[2];
+				blocks.push_back(b);
+			}
+		}
+
+		// Compares a program against the block layouts the application
+		// streams. Reports blocks whose binding or size disagrees with the C++
+		// side, blocks nothing is streamed to and default-block uniforms,
+		// which nothing sets anymore. Returns false if anything was reported.
+		bool validate(GLuint program, const char * name, const std::vector<block_layout> & expected) {
+			std::vector<uniform_info> uniforms;
+			std::vector<block_info> blocks;
+			bool ok = true;
+			reflect(program, uniforms, blocks);
+
+			for (size_t i = 0; i < blocks.size(); i++) {
+				const block_layout * layout = nullptr;
+				for (size_t j = 0; j < expected.size(); j++) {
+					if (blocks[i].name == expected[j].name)
+						layout = &expected[j];
+				}
+				if (!layout) {
+					fprintf(stderr, "%s: uniform block %s is never bound\n", name, blocks[i].name.c_str());
+					ok = false;
+				} else if (blocks[i].binding != (GLint)layout->binding || blocks[i].data_size != (GLint)layout->size) {
+					fprintf(stderr, "%s: uniform block %s is binding %d, %d bytes; expected binding %u, %d bytes\n",
+							name, blocks[i].name.c_str(), blocks[i].binding, blocks[i].data_size,
+							layout->binding, (int)layout->size);
+					ok = false;
+				}
+			}
+
+			for (size_t i = 0; i < uniforms.size(); i++) {
+				if (uniforms[i].block_index == -1 && !is_opaque_type(uniforms[i].type)) {
+					fprintf(stderr, "%s: uniform %s is outside of any block and never set\n", name, uniforms[i].name.c_str());
+					ok = false;
+				}
+			}
+			return ok;
+		}
+	}
+}
+#endif /* __PROGRAM_REFLECTION_H__ */
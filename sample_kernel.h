@@ -0,0 +1,271 @@
+#ifndef __SAMPLE_KERNEL_H__
+#define __SAMPLE_KERNEL_H__
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace sb7 {
+	// Sample sets for the occlusion passes: the hemisphere directions the
+	// sample loop marches along and a tiling blue noise texture to rotate
+	// them per pixel with. Everything is deterministic, so the result of a
+	// generation can be cached on disk with store() and read back with
+	// load() on the next start.
+	namespace sample_kernel {
+		enum distribution {
+			RANDOM,         // rejection sampled, the original kernel
+			POISSON,        // best-candidate Poisson disk on the hemisphere
+			HALTON,         // Halton sequence in bases 2 and 3
+			HAMMERSLEY,     // Hammersley set, visited in golden ratio order
+			COSINE,         // Halton, cosine-weighted around +z
+			DISTRIBUTION_COUNT
+		};
+
+		static const char * const names[DISTRIBUTION_COUNT] = { "random", "poisson", "halton", "hammersley", "cosine" };
+
+		inline bool parse(const char * name, distribution & d) {
+			for (int i = 0; i < DISTRIBUTION_COUNT; i++) {
+				if (strcmp(name, names[i]) == 0) {
+					d = (distribution)i;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		static unsigned int seed = 0x13371337;
+		static inline float random_float() {
+			float res;
+			unsigned int tmp;
+			seed *= 16807;
+			tmp = seed ^ (seed >> 4) ^ (seed << 15);
+			*((unsigned int *)&res) = (tmp >> 9) | 0x3F800000;
+			return (res - 1.0f);
+		}
+
+		inline float radical_inverse(unsigned int i, unsigned int base) {
+			float inv_base = 1.0f / base;
+			float f = inv_base;
+			float r = 0.0f;
+			while (i) {
+				r += f * (i % base);
+				i /= base;
+				f *= inv_base;
+			}
+			return r;
+		}
+
+		// Direction in the +z hemisphere for a point of the unit square, with
+		// z uniform (equal solid angle) or cosine-weighted
+		inline void hemisphere(float u, float v, bool cosine, float * dir) {
+			float z = cosine ? sqrtf(1.0f - u) : u;
+			float r = sqrtf(fmaxf(0.0f, 1.0f - z * z));
+			float phi = 6.2831853f * v;
+			dir[0] = r * cosf(phi);
+			dir[1] = r * sinf(phi);
+			dir[2] = z;
+		}
+
+		// Fills points[i] with count (a power of two) directions (x, y,
+		// z >= 0, 0). Any prefix of the set is itself well distributed, as the
+		// passes use the first point_count points, or with temporal
+		// accumulation consecutive runs of them. Apart from RANDOM the points
+		// are unit length; falloff spreads their lengths down to 1 - falloff,
+		// weighted towards the short end, so that more taps land close to the
+		// pixel.
+		inline void generate(distribution d, float (*points)[4], int count, float falloff = 0.0f) {
+			int i, j, k;
+
+			for (i = 0; i < count; i++) {
+				float u = 0.0f, v = 0.0f;
+				switch (d) {
+				case RANDOM:
+					// Lengths are uniform within the unit ball
+					do {
+						points[i][0] = random_float() * 2.0f - 1.0f;
+						points[i][1] = random_float() * 2.0f - 1.0f;
+						points[i][2] = random_float();
+						points[i][3] = 0.0f;
+					} while (points[i][0] * points[i][0] + points[i][1] * points[i][1] + points[i][2] * points[i][2] > 1.0f);
+					continue;
+				case POISSON: {
+					// Keep whichever of a growing number of candidates is the
+					// farthest from every point placed so far
+					float best = -1.0f;
+					float candidate[3];
+					for (j = 0; j < 8 * i + 1; j++) {
+						hemisphere(random_float(), random_float(), false, candidate);
+						float nearest = 4.0f;
+						for (k = 0; k < i; k++) {
+							float dx = candidate[0] - points[k][0], dy = candidate[1] - points[k][1], dz = candidate[2] - points[k][2];
+							nearest = fminf(nearest, dx * dx + dy * dy + dz * dz);
+						}
+						if (nearest > best) {
+							best = nearest;
+							memcpy(points[i], candidate, sizeof(candidate));
+						}
+					}
+					break;
+				}
+				case HALTON:
+				case COSINE:
+					u = radical_inverse(i + 1, 2);
+					v = radical_inverse(i + 1, 3);
+					hemisphere(u, v, d == COSINE, points[i]);
+					break;
+				case HAMMERSLEY: {
+					// The set is only stratified as a whole; stepping through it
+					// by a stride near count / golden ratio keeps short runs
+					// spread out as well
+					unsigned int stride = (unsigned int)(count * 0.618034f) | 1;
+					unsigned int index = (i * stride) % count;
+					u = (index + 0.5f) / count;
+					v = radical_inverse(index, 2);
+					hemisphere(u, v, false, points[i]);
+					break;
+				}
+				default:
+					break;
+				}
+				// Scale the unit direction by its falloff
+				float t = radical_inverse(i + 1, 5);
+				float length = 1.0f - falloff * (1.0f - t * t);
+				for (j = 0; j < 3; j++)
+					points[i][j] = points[i][j] * length;
+				points[i][3] = 0.0f;
+			}
+		}
+
+		// Void-and-cluster (Ulichney 1993): ranks every texel of a size x size
+		// tile so that thresholding the ranks at any level gives an evenly
+		// spread, tileable pattern. Writes the ranks scaled to 0-255 to every
+		// stride-th byte of texels.
+		inline void blue_noise(unsigned char * texels, int size, int stride, unsigned int noise_seed) {
+			const float sigma = 1.9f;
+			const int n = size * size;
+			std::vector<float> kernel(n), energy(n, 0.0f);
+			std::vector<char> pattern(n, 0);
+			std::vector<int> rank(n);
+			int i, x, y, ones;
+
+			for (y = 0; y < size; y++) {
+				for (x = 0; x < size; x++) {
+					int dx = x <= size / 2 ? x : size - x;
+					int dy = y <= size / 2 ? y : size - y;
+					kernel[y * size + x] = expf(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+				}
+			}
+
+			// Splat or remove the (toroidal) Gaussian of texel p
+			auto toggle = [&](int p, float sign) {
+				int px = p % size, py = p / size;
+				pattern[p] = sign > 0.0f;
+				for (int qy = 0; qy < size; qy++) {
+					const float * row = &kernel[((qy - py + size) % size) * size];
+					float * e = &energy[qy * size];
+					for (int qx = 0; qx < size; qx++)
+						e[qx] += sign * row[(qx - px + size) % size];
+				}
+			};
+			// The set texel with the most energy, or the unset one with the least
+			auto extreme = [&](bool cluster) {
+				int best = -1;
+				for (int p = 0; p < n; p++) {
+					if (pattern[p] != cluster)
+						continue;
+					if (best < 0 || (cluster ? energy[p] > energy[best] : energy[p] < energy[best]))
+						best = p;
+				}
+				return best;
+			};
+
+			// Random initial pattern of a tenth of the texels, then move points
+			// from the tightest cluster to the largest void until that stops
+			// changing anything
+			unsigned int saved_seed = seed;
+			seed = noise_seed;
+			for (ones = 0; ones < n / 10; ) {
+				int p = (int)(random_float() * n) % n;
+				if (!pattern[p]) {
+					toggle(p, 1.0f);
+					ones++;
+				}
+			}
+			seed = saved_seed;
+			for (;;) {
+				int cluster = extreme(true);
+				toggle(cluster, -1.0f);
+				int void_ = extreme(false);
+				toggle(void_, 1.0f);
+				if (void_ == cluster)
+					break;
+			}
+
+			// Rank the initial points by repeatedly removing the tightest
+			// cluster, on a copy so the pattern can be restored
+			std::vector<char> initial(pattern);
+			std::vector<float> initial_energy(energy);
+			for (i = ones - 1; i >= 0; i--) {
+				int p = extreme(true);
+				rank[p] = i;
+				toggle(p, -1.0f);
+			}
+			pattern = initial;
+			energy = initial_energy;
+
+			// Then fill the largest void, one texel at a time
+			for (i = ones; i < n; i++) {
+				int p = extreme(false);
+				rank[p] = i;
+				toggle(p, 1.0f);
+			}
+
+			for (i = 0; i < n; i++)
+				texels[i * stride] = (unsigned char)((rank[i] * 256) / n);
+		}
+
+		// Uniform bytes, to every stride-th byte of texels
+		inline void white_noise(unsigned char * texels, int count, int stride, unsigned int noise_seed) {
+			unsigned int saved_seed = seed;
+			seed = noise_seed;
+			for (int i = 0; i < count; i++)
+				texels[i * stride] = (unsigned char)(random_float() * 256.0f);
+			seed = saved_seed;
+		}
+
+		// Caches of generated data start with this header; load() rejects a
+		// file whose tag or size does not match what is asked for.
+		struct cache_header {
+			unsigned int magic;
+			unsigned int tag;
+			unsigned int size;
+		};
+
+		enum { CACHE_MAGIC = 'S' | 'K' << 8 | 'C' << 16 | '1' << 24 };
+
+		inline bool load(const std::string & filename, unsigned int tag, void * data, size_t size) {
+			FILE * f = fopen(filename.c_str(), "rb");
+			if (!f)
+				return false;
+			cache_header header;
+			bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+					  header.magic == CACHE_MAGIC && header.tag == tag && header.size == size &&
+					  fread(data, 1, size, f) == size;
+			fclose(f);
+			return ok;
+		}
+
+		inline bool store(const std::string & filename, unsigned int tag, const void * data, size_t size) {
+			FILE * f = fopen(filename.c_str(), "wb");
+			if (!f)
+				return false;
+			cache_header header = { CACHE_MAGIC, tag, (unsigned int)size };
+			bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(data, 1, size, f) == size;
+			fclose(f);
+			return ok;
+		}
+	}
+}
+#endif /* __SAMPLE_KERNEL_H__ */
@@ -5,37 +5,128 @@
 #include "gl3w.h"
 #include <cstdio>
 #endif
+#include <cstring>
+#include <string>
+#include <vector>
 
 namespace sb7 {
 	namespace shader {
-		GLuint load(const char * filename, GLenum shader_type = GL_FRAGMENT_SHADER,
+		bool read_file(const char * filename, std::string & text) {
+			FILE * fp = fopen(filename, "rb");
+			if (!fp) return false;
+			fseek(fp, 0, SEEK_END);
+			long filesize = ftell(fp);
+			fseek(fp, 0, SEEK_SET);
+			text.resize(filesize > 0 ? (size_t)filesize : 0);
+			if (filesize > 0)
+				fread(&text[0], 1, text.size(), fp);
+			fclose(fp);
+			return true;
+		}
+
+		// Where preprocess() gets sources from; by default straight from disk.
+		class source_loader {
+		public:
+			virtual ~source_loader() {}
+			virtual bool read(const std::string & name, std::string & text) {
+				return read_file(name.c_str(), text);
+			}
+		};
+
+		// Appends filename to source, replacing every line of the form
+		// #include "name" with the contents of name (resolved relative to the
+		// including file). Each file is only pulled in once, and #line
+		// directives keep compiler messages pointing at the right file; the
+		// source string number is the index of the file in files.
+		bool expand_includes(const char * filename, std::string & source, std::vector<std::string> & files, source_loader & loader, int depth = 0) {
+			std::string text;
+			if (depth > 16 || !loader.read(filename, text)) {
+				fprintf(stderr, "%s: unable to read shader source\n", filename);
+				return false;
+			}
+			int file_index = (int)files.size() - 1;
+			std::string dir(filename);
+			size_t slash = dir.find_last_of("/\\");
+			dir = slash == std::string::npos ? std::string() : dir.substr(0, slash + 1);
+
+			size_t pos = 0;
+			int line = 1;
+			char directive[64];
+			while (pos < text.size()) {
+				size_t eol = text.find('\n', pos);
+				if (eol == std::string::npos) eol = text.size();
+				size_t p = text.find_first_not_of(" \t", pos);
+				size_t q = p < eol && text[p] == '#' ? text.find_first_not_of(" \t", p + 1) : eol;
+				if (q < eol && text.compare(q, 7, "include") == 0) {
+					size_t open = text.find('"', p);
+					size_t close = open < eol ? text.find('"', open + 1) : std::string::npos;
+					if (close >= eol) {
+						fprintf(stderr, "%s(%d): malformed #include\n", filename, line);
+						return false;
+					}
+					std::string path = dir + text.substr(open + 1, close - open - 1);
+					bool seen = false;
+					for (size_t i = 0; i < files.size(); i++)
+						seen |= files[i] == path;
+					if (!seen) {
+						files.push_back(path);
+						snprintf(directive, sizeof(directive), "#line 1 %d\n", (int)files.size() - 1);
+						source += directive;
+						if (!expand_includes(path.c_str(), source, files, loader, depth + 1))
+							return false;
+						snprintf(directive, sizeof(directive), "\n#line %d %d\n", line + 1, file_index);
+						source += directive;
+					} else {
+						source += '\n';
+					}
+				} else {
+					source.append(text, pos, eol - pos);
+					source += '\n';
+				}
+				pos = eol + 1;
+				line++;
+			}
+			return true;
+		}
+
+		// Builds the final source for filename: includes are expanded and
+		// defines (a block of "#define NAME value" lines) is inserted directly
+		// after the #version directive, which GLSL requires to come first.
+		bool preprocess(const char * filename, const char * defines, std::string & source, std::vector<std::string> & files,
+						source_loader * loader = nullptr) {
+			source_loader from_disk;
+			source.clear();
+			files.assign(1, filename);
+			if (!expand_includes(filename, source, files, loader ? *loader : from_disk))
+				return false;
+			if (defines && *defines) {
+				size_t version = source.find("#version");
+				size_t insert_at = version == std::string::npos ? 0 : source.find('\n', version) + 1;
+				int line = 1;
+				for (size_t i = 0; i < insert_at; i++)
+					line += source[i] == '\n';
+				char directive[32];
+				snprintf(directive, sizeof(directive), "#line %d 0\n", line);
+				source.insert(insert_at, std::string(defines) + (defines[strlen(defines) - 1] == '\n' ? "" : "\n") + directive);
+			}
+			return true;
+		}
+
+		GLuint load_with_defines(const char * filename, GLenum shader_type, const char * defines,
 #ifdef _DEBUG
 		bool check_errors = true)
 #else
 		bool check_errors = false)
 #endif
 		{
-			GLuint result = 0;
-			FILE * fp;
-			size_t filesize;
-			char * data;
-			fp = fopen(filename, "rb");
-			if (!fp) return 0;
-			fseek(fp, 0, SEEK_END);
-			filesize = ftell(fp);
-			fseek(fp, 0, SEEK_SET);
-			data = new char[filesize + 1];
-
-			if (!data)
-				goto fail_data_alloc;
-
-			fread(data, 1, filesize, fp);
-			data[filesize] = 0;
-			fclose(fp);
-			result = glCreateShader(shader_type);
-			if (!result) goto fail_shader_alloc;
+			std::string source;
+			std::vector<std::string> files;
+			if (!preprocess(filename, defines, source, files))
+				return 0;
+			GLuint result = glCreateShader(shader_type);
+			if (!result) return 0;
+			const char * data = source.c_str();
 			glShaderSource(result, 1, &data, NULL);
-			delete[] data;
 			glCompileShader(result);
 			if (check_errors) {
 				GLint status = 0;
@@ -50,16 +141,24 @@ namespace sb7 {
 					OutputDebugStringA("\n");
 #else
 					fprintf(stderr, "%s: %s\n", filename, buffer);
+					for (size_t i = 1; i < files.size(); i++)
+						fprintf(stderr, "  source %d: %s\n", (int)i, files[i].c_str());
 #endif
-					goto fail_compile_shader;
+					glDeleteShader(result);
+					return 0;
 				}
 			}
 			return result;
-		fail_compile_shader:
-			glDeleteShader(result);
-		fail_shader_alloc:;
-		fail_data_alloc:
-			return result;
+		}
+
+		GLuint load(const char * filename, GLenum shader_type = GL_FRAGMENT_SHADER,
+#ifdef _DEBUG
+		bool check_errors = true)
+#else
+		bool check_errors = false)
+#endif
+		{
+			return load_with_defines(filename, shader_type, "", check_errors);
 		}
 	}
 
@@ -102,6 +201,60 @@ namespace sb7 {
 			}
 			return program;
 		}
+
+		// Turns on KHR_parallel_shader_compile (or its ARB twin) when the
+		// driver exposes it and lets the driver pick the number of compiler
+		// threads. Returns true if GL_COMPLETION_STATUS_KHR may be polled.
+		bool enable_parallel_compile() {
+			GLint count = 0;
+			glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+			for (GLint i = 0; i < count; i++) {
+				const char * name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+				const char * entry_point = nullptr;
+				if (!strcmp(name, "GL_KHR_parallel_shader_compile"))
+					entry_point = "glMaxShaderCompilerThreadsKHR";
+				else if (!strcmp(name, "GL_ARB_parallel_shader_compile"))
+					entry_point = "glMaxShaderCompilerThreadsARB";
+				if (entry_point) {
+					PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_threads =
+						(PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)gl3wGetProcAddress(entry_point);
+					if (max_threads)
+						max_threads(0xFFFFFFFFu);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Prints the info logs of a program that failed to link and of any
+		// of its shaders that failed to compile.
+		void print_errors(GLuint program, const GLuint * shaders, int shader_count, const char * name) {
+			char buffer[4096];
+			GLint status;
+			for (int i = 0; i < shader_count; i++) {
+				glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &status);
+				if (!status) {
+					glGetShaderInfoLog(shaders[i], 4096, NULL, buffer);
+#ifdef _WIN32
+					OutputDebugStringA(name);
+					OutputDebugStringA(":");
+					OutputDebugStringA(buffer);
+					OutputDebugStringA("\n");
+#else
+					fprintf(stderr, "%s: %s\n", name, buffer);
+#endif
+				}
+			}
+			glGetProgramInfoLog(program, 4096, NULL, buffer);
+#ifdef _WIN32
+			OutputDebugStringA(name);
+			OutputDebugStringA(":");
+			OutputDebugStringA(buffer);
+			OutputDebugStringA("\n");
+#else
+			fprintf(stderr, "%s: %s\n", name, buffer);
+#endif
+		}
 	}
 }
 #endif /* __SHADER_H__ */
@@ -0,0 +1,177 @@
+#ifndef __SHADERPACK_H__
+#define __SHADERPACK_H__
+
+#include <cstddef>
+
+// A shader pack bundles every shader source into one file: a header, an
+// open-addressed hash table of entries keyed by FNV-1a of the shader name
+// and the NUL-terminated names and sources the entries point at. The table
+// is mapped straight from disk, so looking a shader up is a hash and
+// (usually) one probe. Packs are written by tools/shaderpack.cpp.
+
+#define SBPK_FOURCC(a,b,c,d)            ( ((unsigned int)(a) << 0) | ((unsigned int)(b) << 8) | ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24) )
+#define SBPK_MAGIC                      SBPK_FOURCC('S', 'B', 'P', 'K')
+#define SBPK_VERSION                    1
+
+typedef struct SBPK_HEADER_t {
+	unsigned int        magic;
+	unsigned int        version;
+	unsigned int        entry_count;
+	unsigned int        bucket_count;   // power of two, entries follow the header
+} SBPK_HEADER;
+
+typedef struct SBPK_ENTRY_t {
+	unsigned int        hash;
+	unsigned int        name_offset;    // from the start of the file
+	unsigned int        name_length;    // 0 marks an empty bucket
+	unsigned int        data_offset;
+	unsigned int        data_length;    // excluding the terminating NUL
+} SBPK_ENTRY;
+
+static inline unsigned int sbpk_hash(const char * name, size_t length) {
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+#ifndef SBPK_FILETYPES_ONLY
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace sb7 {
+	class shader_pack {
+	public:
+		shader_pack() : base(nullptr), size(0), mapped(false) {}
+		~shader_pack() {
+			close();
+		}
+
+		bool open(const char * filename) {
+			close();
+#ifdef __linux__
+			int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return false;
+			struct stat st;
+			if (fstat(fd, &st) == 0 && st.st_size > 0) {
+				void * ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (ptr != MAP_FAILED) {
+					base = (const char *)ptr;
+					size = st.st_size;
+					mapped = true;
+				}
+			}
+			::close(fd);
+#else
+			FILE * fp = fopen(filename, "rb");
+			if (!fp)
+				return false;
+			fseek(fp, 0, SEEK_END);
+			long filesize = ftell(fp);
+			fseek(fp, 0, SEEK_SET);
+			if (filesize > 0) {
+				char * data = new char[filesize];
+				fread(data, 1, filesize, fp);
+				base = data;
+				size = filesize;
+			}
+			fclose(fp);
+#endif
+			if (!valid()) {
+				fprintf(stderr, "%s: not a valid shader pack\n", filename);
+				close();
+				return false;
+			}
+			return true;
+		}
+
+		void close() {
+#ifdef __linux__
+			if (mapped)
+				munmap((void *)base, size);
+#endif
+			if (!mapped)
+				delete[] base;
+			base = nullptr;
+			size = 0;
+			mapped = false;
+		}
+
+		bool is_open() const {
+			return base != nullptr;
+		}
+
+		// Returns the NUL-terminated source stored under name, or nullptr.
+		const char * find(const std::string & name, size_t * length = nullptr) const {
+			if (!base)
+				return nullptr;
+			const SBPK_HEADER * header = (const SBPK_HEADER *)base;
+			const SBPK_ENTRY * entries = (const SBPK_ENTRY *)(header + 1);
+			unsigned int hash = sbpk_hash(name.c_str(), name.size());
+			unsigned int mask = header->bucket_count - 1;
+			for (unsigned int i = hash & mask; entries[i].name_length != 0; i = (i + 1) & mask) {
+				const SBPK_ENTRY & e = entries[i];
+				if (e.hash == hash && e.name_length == name.size() &&
+					memcmp(base + e.name_offset, name.c_str(), name.size()) == 0) {
+					if (length)
+						*length = e.data_length;
+					return base + e.data_offset;
+				}
+			}
+			return nullptr;
+		}
+
+		void names(std::vector<std::string> & out) const {
+			if (!base)
+				return;
+			const SBPK_HEADER * header = (const SBPK_HEADER *)base;
+			const SBPK_ENTRY * entries = (const SBPK_ENTRY *)(header + 1);
+			for (unsigned int i = 0; i < header->bucket_count; i++) {
+				if (entries[i].name_length)
+					out.push_back(std::string(base + entries[i].name_offset, entries[i].name_length));
+			}
+		}
+
+	private:
+		// Everything find() dereferences has to lie inside the file
+		bool valid() const {
+			if (!base || size < sizeof(SBPK_HEADER))
+				return false;
+			const SBPK_HEADER * header = (const SBPK_HEADER *)base;
+			if (header->magic != SBPK_MAGIC || header->version != SBPK_VERSION ||
+				header->bucket_count == 0 || (header->bucket_count & (header->bucket_count - 1)) != 0 ||
+				header->entry_count >= header->bucket_count ||
+				sizeof(SBPK_HEADER) + (size_t)header->bucket_count * sizeof(SBPK_ENTRY) > size)
+				return false;
+			const SBPK_ENTRY * entries = (const SBPK_ENTRY *)(header + 1);
+			for (unsigned int i = 0; i < header->bucket_count; i++) {
+				const SBPK_ENTRY & e = entries[i];
+				if (e.name_length == 0)
+					continue;
+				if ((size_t)e.name_offset + e.name_length > size ||
+					(size_t)e.data_offset + e.data_length >= size ||
+					base[e.data_offset + e.data_length] != '\0')
+					return false;
+			}
+			return true;
+		}
+
+		const char *    base;
+		size_t          size;
+		bool            mapped;
+	};
+}
+#endif /* SBPK_FILETYPES_ONLY */
+#endif /* __SHADERPACK_H__ */
@@ -13,38 +13,104 @@
 #include <unistd.h>
 #include "gl3w.h"
 #include <GLFW/glfw3.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #endif
 
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <cstddef>
 #include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
 #include "shader.h"
+#include "program_cache.h"
+#include "uniform_ring.h"
+#include "gpu_timer.h"
+#include "gpu_profiler.h"
+#include "cpu_trace.h"
+#include "frame_capture.h"
+#include "image_compare.h"
+#include "media.h"
 #include "object.h"
+#include "sample_kernel.h"
 #include "vmath.h"
 
-static unsigned int seed = 0x13371337;
-static inline float random_float() {
-	float res;
-	unsigned int tmp;
-	seed *= 16807;
-	tmp = seed ^ (seed >> 4) ^ (seed << 15);
-	*((unsigned int *)&res) = (tmp >> 9) | 0x3F800000;
-	return (res - 1.0f);
-}
-
 class ssao_app {
 public:
 	ssao_app()
 		: render_program(0),
 		ssao_program(0),
+		ao_program(0),
+		ssao_background_program(0),
+		ao_background_program(0),
+		downsample_program(0),
+		composite_program(0),
 		paused(false),
+		compact_gbuffer(false),
 		ssao_level(1.0f),
 		ssao_radius(0.05f),
 		show_shading(true),
 		show_ao(true),
 		weight_by_angle(true),
 		randomize_points(true),
-		point_count(10) {}
+		specialize_shaders(true),
+		point_count(6),
+		step_count(4),
+		ao_scale(1),
+		split_passes(true),
+		blur_ao(true),
+		ao_path(AO_PATH_FRAGMENT),
+		ao_technique(AO_TECHNIQUE_POINTS),
+		kernel(sb7::sample_kernel::RANDOM),
+		kernel_falloff(0.0f),
+		blue_noise(false),
+		noise_texture(0),
+		reinterleave_program(0),
+		temporal_ao(true),
+		temporal_program(0),
+		history_index(0),
+		history_valid(false),
+		frame_index(0),
+		dynamic_resolution(false),
+		target_frame_ms(16.7f),
+		min_render_scale(0.5f),
+		max_render_scale(1.0f),
+		render_scale(1.0f),
+		quality_governor(false),
+		ao_budget_ms(2.0f),
+		quality_level(0),
+		profiling(false),
+		benchmark(false),
+		benchmark_warmup(30),
+		benchmark_frames(300),
+		requested_width(0),
+		requested_height(0),
+		last_time(0.0),
+		total_time(0.0),
+		camera_path(false),
+		headless(false),
+		output_fbo(0),
+		output_texture(0),
+		output_stencil(0),
+#ifdef __linux__
+		egl_display(EGL_NO_DISPLAY),
+		egl_context(EGL_NO_CONTEXT),
+#endif
+		capturing(false),
+		captured_frames(0),
+		golden_update(false),
+		golden_min_psnr(40.0f),
+		golden_min_ssim(0.98f),
+		golden_time_tolerance(0.25f) {
+		blur_programs[0] = blur_programs[1] = 0;
+		depth_mip_programs[0] = depth_mip_programs[1] = 0;
+		deinterleave_programs[0] = deinterleave_programs[1] = 0;
+	}
 
 	void initFirst() {
 		strcpy(info.title, "SSAO");
@@ -57,14 +123,66 @@ public:
 		info.flags.cursor = 1;
 	}
 
-	void run(ssao_app* the_app) {
+	// Returns the exit status: 0 unless no context could be created, the
+	// shaders failed to build, or a headless, benchmark or golden image run
+	// failed
+	int run(ssao_app* the_app) {
 		bool running = true;
+		bool ok = true;
 		app = the_app;
+		window = nullptr;
+		initFirst();
+		if (requested_width) {
+			info.windowWidth = requested_width;
+			info.windowHeight = requested_height;
+		}
+		if (!(headless ? create_headless_context() : create_window()))
+			return 1;
+		gl3wInit();
+		sb7::trace::thread_name("main");
+		startup();
+		if (capturing && !start_capture()) {
+			ok = false;
+		} else if (!interactive() && !(render_program && ssao_program)) {
+			fprintf(stderr, "Failed to build the shaders\n");
+			ok = false;
+		} else if (!golden_dir.empty()) {
+			ok = run_golden();
+		} else if (benchmark) {
+			ok = run_benchmark();
+		} else if (headless) {
+			ok = run_headless();
+		}
+		while (running && interactive()) {
+			sb7::trace::scope trace("frame");
+			render(glfwGetTime());
+			if (profiling)
+				profiler.begin(PROFILE_SWAP);
+			present();
+			if (profiling)
+				profiler.end(PROFILE_SWAP);
+			{
+				sb7::trace::scope trace("poll events");
+				glfwPollEvents();
+			}
+			running &= (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_RELEASE);
+			running &= (glfwWindowShouldClose(window) != GL_TRUE);
+		}
+		if (profiling)
+			report_profile();
+		if (!capture_pattern.empty())
+			ok &= finish_capture();
+		if (sb7::trace::enabled())
+			write_trace();
+		destroy_context();
+		return ok ? 0 : 1;
+	}
+
+	bool create_window() {
 		if (!glfwInit()) {
 			fprintf(stderr, "Failed to initialize GLFW\n");
-			return;
+			return false;
 		}
-		initFirst();
 		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, info.majorVersion);
 		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, info.minorVersion);
 
@@ -75,32 +193,91 @@ public:
 		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 		glfwWindowHint(GLFW_SAMPLES, info.samples);
 		glfwWindowHint(GLFW_STEREO, info.flags.stereo ? GL_TRUE : GL_FALSE);
+		glfwWindowHint(GLFW_VISIBLE, headless ? GL_FALSE : GL_TRUE);
+		glfwWindowHint(GLFW_STENCIL_BITS, 8);
 		{
-			window = glfwCreateWindow(info.windowWidth, info.windowHeight, info.title, info.flags.fullscreen ? glfwGetPrimaryMonitor() : NULL, NULL);
+			window = glfwCreateWindow(info.windowWidth, info.windowHeight, info.title, info.flags.fullscreen && !headless ? glfwGetPrimaryMonitor() : NULL, NULL);
 			if (!window) {
 				fprintf(stderr, "Failed to open window\n");
-				return;
+				glfwTerminate();
+				return false;
 			}
 		}
 		glfwMakeContextCurrent(window);
-		glfwSetWindowSizeCallback(window, glfw_onResize);
+		// Everything is sized in pixels, which need not match the window's
+		// screen coordinates
+		glfwGetFramebufferSize(window, &info.windowWidth, &info.windowHeight);
+		glfwSetFramebufferSizeCallback(window, glfw_onResize);
 		glfwSetKeyCallback(window, glfw_onKey);
 		if (!info.flags.cursor) {
 			glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
 		}
-		gl3wInit();
-		startup();
-		do {
-			render(glfwGetTime());
-			glfwSwapBuffers(window);
-			glfwPollEvents();
-			running &= (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_RELEASE);
-			running &= (glfwWindowShouldClose(window) != GL_TRUE);
-		} while (running);
+		return true;
+	}
+
+	// Creates a context without a visible window. On Linux that is an EGL
+	// context on Mesa's surfaceless platform, which needs no display
+	// server; elsewhere, or where that is not available, a hidden window.
+	bool create_headless_context() {
+#ifdef __linux__
+		const char * extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless") && get_platform_display) {
+			egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+			if (egl_display != EGL_NO_DISPLAY && eglInitialize(egl_display, NULL, NULL)) {
+				const EGLint attributes[] = {
+					EGL_CONTEXT_MAJOR_VERSION, info.majorVersion,
+					EGL_CONTEXT_MINOR_VERSION, info.minorVersion,
+					EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+					EGL_NONE
+				};
+				eglBindAPI(EGL_OPENGL_API);
+				egl_context = eglCreateContext(egl_display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+				if (egl_context != EGL_NO_CONTEXT &&
+					eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+					return true;
+				if (egl_context != EGL_NO_CONTEXT)
+					eglDestroyContext(egl_display, egl_context);
+				egl_context = EGL_NO_CONTEXT;
+				eglTerminate(egl_display);
+			}
+			egl_display = EGL_NO_DISPLAY;
+		}
+		fprintf(stderr, "No surfaceless EGL, using a hidden window\n");
+#endif
+		return create_window();
+	}
+
+	void destroy_context() {
+#ifdef __linux__
+		if (egl_display != EGL_NO_DISPLAY) {
+			eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext(egl_display, egl_context);
+			eglTerminate(egl_display);
+			return;
+		}
+#endif
 		glfwDestroyWindow(window);
 		glfwTerminate();
 	}
 
+	// Whether frames are rendered until the window is closed
+	bool interactive() const {
+		return !headless && !benchmark && golden_dir.empty();
+	}
+
+	// Shows the finished frame. Headless it is only flushed, so that the
+	// CPU does not run arbitrarily far ahead of the GPU.
+	void present() {
+		sb7::trace::scope trace("swap");
+		if (window)
+			glfwSwapBuffers(window);
+		else
+			glFlush();
+	}
+
+	bool parse_arguments(int argc, char ** argv);
 	void startup();
 	void render(double currentTime);
 	void onKey(int key, int action);
@@ -131,32 +308,83 @@ protected:
 	GLFWwindow* window;
 
 	void load_shaders();
+	void write_trace();
+	bool parse_sweep(const char * arg);
+	void apply_parameter(int parameter, float value);
+	bool run_benchmark();
+	bool run_headless();
+	void rewind();
+	void read_frame(sb7::image::rgb & image);
+	bool run_golden();
+	bool start_capture();
+	bool finish_capture();
+	void create_sample_points();
+	void fit_targets(bool shrink);
+	void update_render_scale();
+	void set_render_scale(float scale);
+	void start_governor();
+	void set_quality_level(int level);
+	void govern_quality();
+	void report_target_memory() const;
+	void create_gbuffer();
+	void select_programs();
+	GLuint select_ssao_variant(const char * base_defines, bool compute = false);
+	float pass_radius() const;
+	int compute_apron(bool & lds_only) const;
+	void create_ao_targets();
+	void render_ao();
+	void draw_covered(GLuint stencil_fbo, GLsizei width, GLsizei height);
+	void draw_single_pass();
+	bool begin_coverage();
+	void end_coverage(bool counting, GLuint total);
+	void update_coverage();
+	void report_profile();
+	void build_depth_pyramid(GLuint normal_depth, GLsizei width, GLsizei height);
+	void render_ao_layers(GLuint normal_depth, GLsizei width, GLsizei height);
+	void bind_ao_layer(int i);
+	bool split_programs_ready() const;
 
+	sb7::program_cache programs;
 	GLuint      render_program;
 	GLuint      ssao_program;
+	GLuint      ao_program;
+	// The two above shading only the background, see draw_single_pass
+	GLuint      ssao_background_program;
+	GLuint      ao_background_program;
+	GLuint      downsample_program;
+	GLuint      composite_program;
+	GLuint      blur_programs[2];   // horizontal, vertical
+	GLuint      depth_mip_programs[2];  // first level, further levels
 	bool        paused;
 	GLuint      render_fbo;
-	GLuint      fbo_textures[3];
+	GLuint      fbo_textures[4];    // color, normal and depth, depth and stencil, motion
+
+	// Every render target is sized for target_width x target_height (see
+	// fit_targets), or that divided by ao_scale, and takes gbuffer_bytes or
+	// ao_target_bytes. ssao_radius is a fraction of REFERENCE_TARGET_WIDTH,
+	// the width the G-buffer had before it followed the framebuffer, and is
+	// passed on to the shaders in pixels.
+	GLsizei     target_width;
+	GLsizei     target_height;
+	GLint       max_target_size;
+	GLint       max_shared_memory;  // of a compute workgroup, in bytes
+	int         shrink_countdown;
+	size_t      gbuffer_bytes;
+	size_t      ao_target_bytes;
+	enum { SHRINK_DELAY = 60 };
+	enum { REFERENCE_TARGET_WIDTH = 2048 };
+
+	// The compact G-buffer layout stores the color in RGB10_A2 and only the
+	// octahedral encoded normal in RG16, and the passes after the geometry
+	// pass linearize the depth buffer for depth; see gbuffer.glsl. 20 bytes
+	// per pixel rather than 36, and a quarter of the bytes per depth tap.
+	bool        compact_gbuffer;
 	GLuint      quad_vao;
 	GLuint      points_buffer;
 	sb7::object object;
 	sb7::object cube;
 
-	struct {
-		struct {
-			GLint           mv_matrix;
-			GLint           proj_matrix;
-			GLint           shading_level;
-		} render;
-		struct {
-			GLint           ssao_level;
-			GLint           object_level;
-			GLint           ssao_radius;
-			GLint           weight_by_angle;
-			GLint           randomize_points;
-			GLint           point_count;
-		} ssao;
-	} uniforms;
+	sb7::uniform_ring uniform_ring;
 
 	bool  show_shading;
 	bool  show_ao;
@@ -164,16 +392,275 @@ protected:
 	float ssao_radius;
 	bool  weight_by_angle;
 	bool randomize_points;
+	bool specialize_shaders;
 	unsigned int point_count;
+	unsigned int step_count;
+
+	// Ambient occlusion is computed at 1/ao_scale of the resolution into
+	// ao_textures, blurred, and applied by composite.fs.glsl, which also
+	// upsamples it. With split_passes off and at full resolution the
+	// original single pass ssao.fs.glsl is used instead.
+	unsigned int ao_scale;
+	bool        split_passes;
+	bool        blur_ao;
+	GLuint      ao_fbos[3];
+	GLuint      ao_textures[3];     // downsampled normal and depth, occlusion, blur temporary
+
+	// The geometry pass sets the stencil where it draws, and below full
+	// resolution the downsample pass marks the blocks holding geometry in
+	// ao_depth_stencil, which also holds their depth with compact_gbuffer.
+	// The fragment occlusion passes are stencil tested so that background
+	// pixels are never shaded; coverage_query counts the pixels that were,
+	// and skipped_pixels, the percentage skipped as last read back, is
+	// shown in the window title and reported with the profile, benchmark
+	// and golden image results. As the passes
+	// drawing into ao_fbos[1] may sample either depth buffer, the stencil
+	// is blitted into ao_stencil, which is attached there instead.
+	GLuint      ao_depth_stencil;
+	GLuint      ao_stencil;
+	GLuint      coverage_query;
+	bool        coverage_pending;
+	GLuint      coverage_total;
+	float       skipped_pixels;     // -1 until measured
+
+	// How the split pipeline computes occlusion: a full-screen fragment
+	// shader, the same reading a depth pyramid, on deinterleaved layers, or
+	// a compute shader caching tiles of depth in shared memory
+	enum {
+		AO_PATH_FRAGMENT,
+		AO_PATH_DEPTH_MIPS,
+		AO_PATH_DEINTERLEAVED,
+		AO_PATH_COMPUTE
+	};
+	int         ao_path;
+
+	// What the occlusion passes integrate: the original point marching of
+	// occlusion.glsl or the horizon-based horizon.glsl. Either works with
+	// every path above and with the single pass.
+	enum {
+		AO_TECHNIQUE_POINTS,
+		AO_TECHNIQUE_HORIZON
+	};
+	int         ao_technique;
+
+	// Chosen on the command line, see parse_arguments. The per-pixel random
+	// vector of the occlusion passes is read from noise_texture, tiled over
+	// the screen, which holds blue noise with blue_noise and white noise
+	// otherwise.
+	sb7::sample_kernel::distribution kernel;
+	float       kernel_falloff;
+	bool        blue_noise;
+	GLuint      noise_texture;
+	enum { NOISE_SIZE = 64 };
+
+	// Linear depth at the occlusion resolution and DEPTH_MIP_LEVELS - 1
+	// halvings of it
+	enum { DEPTH_MIP_LEVELS = 5 };
+	GLuint      depth_pyramid;
+	GLuint      depth_pyramid_fbo;
+
+	// Deinterleaved occlusion: the normal and depth are split into
+	// AO_LAYERS quarter resolution layers, one per pixel of each 4x4 block.
+	// Each layer is shaded with a single random vector, so neighbouring
+	// texels take neighbouring taps, and the layers are put back together
+	// into ao_textures[1].
+	enum { AO_LAYERS = 16 };
+	GLuint      deinterleave_programs[2];   // layers 0-7, 8-15
+	GLuint      reinterleave_program;
+	GLuint      deinterleave_fbos[2];
+	GLuint      ao_layer_fbo;
+	GLuint      layer_textures[2];  // normal and depth, occlusion
+	GLuint      layer_stencil;      // marking each layer's geometry
+
+	// Temporal accumulation: each frame samples a different subset of the
+	// points, and temporal.fs.glsl blends the result into the previous
+	// frame's, reprojected with the motion the geometry pass writes.
+	// history_textures alternate between being read and written.
+	bool        temporal_ao;
+	GLuint      temporal_program;
+	GLuint      history_fbos[2];
+	GLuint      history_textures[2];    // occlusion, depth, octahedral normal
+	int         history_index;
+	bool        history_valid;
+	unsigned int frame_index;
+	vmath::mat4 prev_proj_matrix;
+	vmath::mat4 prev_mv_matrices[2];
+
+	// Dynamic resolution: the geometry and occlusion passes render
+	// render_width x render_height, render_scale of the framebuffer in each
+	// direction, and the composite scales that up to the framebuffer. With
+	// dynamic_resolution every frame's GPU time is measured by frame_timer,
+	// tagged with scale_generation, and update_render_scale moves the scale
+	// between min_render_scale and max_render_scale to hold target_frame_ms.
+	bool        dynamic_resolution;
+	float       target_frame_ms;
+	float       min_render_scale;
+	float       max_render_scale;
+	float       render_scale;
+	GLsizei     render_width;
+	GLsizei     render_height;
+	sb7::gpu_timer frame_timer;
+	unsigned int scale_generation;  // changes with render_scale
+	float       frame_ms;           // smoothed over the frames measured at render_scale
+	int         frame_samples;      // how many those are
+
+	// Quality governor: with quality_governor the occlusion passes are timed
+	// by ao_timer, and govern_quality walks quality_levels, which set
+	// point_count and step_count, to keep them within ao_budget_ms. Every
+	// decision is printed.
+	bool        quality_governor;
+	float       ao_budget_ms;
+	int         quality_level;
+	sb7::gpu_timer ao_timer;
+	unsigned int quality_generation;    // changes with quality_level
+	float       ao_ms;
+	int         ao_samples;
+
+	// Both controllers act on the average of this many frames measured with
+	// the current settings
+	enum { CONTROL_SAMPLES = 8 };
+
+	// With profiling the GPU time of each pass is collected by profiler,
+	// which prints it on exit or when profiling is turned off. The single
+	// pass ssao.fs.glsl counts as occlusion and leaves composite empty.
+	enum { PROFILE_GEOMETRY, PROFILE_OCCLUSION, PROFILE_COMPOSITE, PROFILE_SWAP };
+	bool        profiling;
+	sb7::gpu_profiler profiler;
+
+	// CPU scopes are recorded by sb7::trace while it is enabled and written
+	// to trace_filename as Chrome trace JSON on exit or with J
+	std::string trace_filename;
+
+	// Benchmark mode: every combination of the sweeps' values is rendered
+	// for benchmark_warmup and then benchmark_frames frames, with a fixed
+	// timestep and camera_path, and the CPU and GPU time of each measured
+	// frame goes to benchmark_csv. See run_benchmark.
+	enum { SWEEP_POINTS, SWEEP_STEPS, SWEEP_RADIUS, SWEEP_SCALE, SWEEP_AO_SCALE, SWEEP_PARAMETERS };
+	struct sweep {
+		int                 parameter;
+		std::vector<float>  values;
+	};
+	bool        benchmark;
+	int         benchmark_warmup;
+	int         benchmark_frames;
+	std::string benchmark_csv;
+	std::vector<sweep> sweeps;
+	int         requested_width;    // of the window, 0 for the default
+	int         requested_height;
+
+	// Scene time, which only advances while not paused
+	double      last_time;
+	double      total_time;
+
+	// Moves the camera in and out and up and down over time, so that
+	// benchmark frames cover the scene from more than one distance
+	bool        camera_path;
+
+	// Headless, the context has no visible window (see
+	// create_headless_context) and frames are composited into output_fbo
+	// rather than the default framebuffer. Without --benchmark
+	// benchmark_frames frames are rendered and the app exits.
+	bool        headless;
+	GLuint      output_fbo;
+	GLuint      output_texture;
+	GLuint      output_stencil;
+#ifdef __linux__
+	EGLDisplay  egl_display;
+	EGLContext  egl_context;
+#endif
+
+	// While capturing every frame is read back asynchronously by capture
+	// and written to capture_pattern, see sb7::frame_capture
+	bool        capturing;
+	std::string capture_pattern;    // empty until capture is started
+	sb7::frame_capture capture;
+	int         captured_frames;
+
+	// The golden image check, see run_golden. With golden_update the
+	// references in golden_dir are written rather than compared against.
+	std::string golden_dir;
+	bool        golden_update;
+	float       golden_min_psnr;
+	float       golden_min_ssim;
+	float       golden_time_tolerance;  // over the baseline, 0.25 for 25%
 
 	struct SAMPLE_POINTS {
 		vmath::vec4     point[256];
 		vmath::vec4     random_vectors[256];
 	};
 
+	// std140 uniform blocks, see media/shaders/ssao/uniforms.glsl
+	enum {
+		SAMPLE_POINTS_BINDING = 0,
+		FRAME_BINDING = 1,
+		GEOMETRY_PASS_BINDING = 2,
+		OBJECT_BINDING = 3,
+		SSAO_PASS_BINDING = 4,
+		AO_LAYER_BINDING = 5
+	};
+
+	struct FRAME {
+		vmath::mat4     proj_matrix;
+		vmath::mat4     prev_proj_matrix;
+		float           viewport_size[2];
+		float           target_size[2];
+		float           output_size[2];
+		float           padding[2];     // std140 rounds blocks up to a vec4
+	};
+
+	struct GEOMETRY_PASS {
+		float           shading_level;
+		float           padding[3];
+	};
+
+	struct OBJECT {
+		vmath::mat4     mv_matrix;
+		vmath::mat4     prev_mv_matrix;
+	};
+
+	struct SSAO_PASS {
+		float           ssao_level;
+		float           object_level;
+		float           ssao_radius;
+		unsigned int    point_count;
+		int             randomize_points;
+		int             weight_by_angle;
+		unsigned int    point_offset;
+		float           history_weight;
+		unsigned int    step_count;
+		unsigned int    padding[3];
+	};
+
+	static_assert(sizeof(vmath::mat4) == 64, "mat4 must be tightly packed column-major floats");
+	static_assert(sizeof(vmath::vec4) == 16, "vec4 must be four tightly packed floats");
+	static_assert(offsetof(FRAME, prev_proj_matrix) == 64 &&
+				  offsetof(FRAME, viewport_size) == 128 &&
+				  offsetof(FRAME, target_size) == 136 &&
+				  offsetof(FRAME, output_size) == 144 &&
+				  sizeof(FRAME) == 160, "FRAME does not match std140");
+	static_assert(sizeof(GEOMETRY_PASS) == 16, "GEOMETRY_PASS does not match std140");
+	static_assert(offsetof(OBJECT, prev_mv_matrix) == 64 &&
+				  sizeof(OBJECT) == 128, "OBJECT does not match std140");
+	static_assert(offsetof(SSAO_PASS, ssao_radius) == 8 &&
+				  offsetof(SSAO_PASS, point_count) == 12 &&
+				  offsetof(SSAO_PASS, weight_by_angle) == 20 &&
+				  offsetof(SSAO_PASS, history_weight) == 28 &&
+				  offsetof(SSAO_PASS, step_count) == 32 &&
+				  sizeof(SSAO_PASS) == 48, "SSAO_PASS does not match std140");
+
+	struct AO_LAYER {
+		int             offset[2];
+		int             index;
+		int             padding;
+	};
+
+	static_assert(offsetof(AO_LAYER, index) == 8 &&
+				  sizeof(AO_LAYER) == 16, "AO_LAYER does not match std140");
+
 	void onResize(int w, int h) {
 		info.windowWidth = w;
 		info.windowHeight = h;
+		fit_targets(false);
 	}
 
 	static void glfw_onResize(GLFWwindow* window, int w, int h) {
@@ -186,65 +673,420 @@ protected:
 };
 
 void ssao_app::startup() {
+	sb7::trace::scope trace("startup");
+
+	programs.expect_block("SAMPLE_POINTS", SAMPLE_POINTS_BINDING, sizeof(SAMPLE_POINTS));
+	programs.expect_block("FRAME", FRAME_BINDING, sizeof(FRAME));
+	programs.expect_block("GEOMETRY_PASS", GEOMETRY_PASS_BINDING, sizeof(GEOMETRY_PASS));
+	programs.expect_block("OBJECT", OBJECT_BINDING, sizeof(OBJECT));
+	programs.expect_block("SSAO_PASS", SSAO_PASS_BINDING, sizeof(SSAO_PASS));
+	programs.expect_block("AO_LAYER", AO_LAYER_BINDING, sizeof(AO_LAYER));
+	uniform_ring.init(16384);
+	programs.set_sources(sb7::media::build_path("shaders.pack"), sb7::media::path("shaders/"));
+	// The compute variant's apron depends on the render size
+	glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &max_shared_memory);
+	render_scale = dynamic_resolution ? max_render_scale : 1.0f;
+	render_width = std::max(1, (int)(info.windowWidth * render_scale + 0.5f));
+	render_height = std::max(1, (int)(info.windowHeight * render_scale + 0.5f));
 	load_shaders();
 	glGenFramebuffers(1, &render_fbo);
 	glBindFramebuffer(GL_FRAMEBUFFER, render_fbo);
-	glGenTextures(3, fbo_textures);
-	glBindTexture(GL_TEXTURE_2D, fbo_textures[0]);
-	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB16F, 2048, 2048);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glBindTexture(GL_TEXTURE_2D, fbo_textures[1]);
-	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, 2048, 2048);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glBindTexture(GL_TEXTURE_2D, fbo_textures[2]);
-	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, 2048, 2048);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, fbo_textures[0], 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, fbo_textures[1], 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, fbo_textures[2], 0);
-	static const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-	glDrawBuffers(2, draw_buffers);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGenTextures(4, fbo_textures);
+	static const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+	glDrawBuffers(3, draw_buffers);
+	glGenFramebuffers(3, ao_fbos);
+	glGenTextures(3, ao_textures);
+	glGenTextures(1, &ao_depth_stencil);
+	glGenRenderbuffers(1, &ao_stencil);
+	glGenQueries(1, &coverage_query);
+	coverage_pending = false;
+	skipped_pixels = -1.0f;
+	frame_timer.init();
+	scale_generation = 0;
+	frame_samples = 0;
+	ao_timer.init();
+	quality_generation = 0;
+	ao_samples = 0;
+	if (quality_governor)
+		start_governor();
+	profiler.add("geometry");
+	profiler.add("occlusion");
+	profiler.add("composite");
+	profiler.add("swap");
+	glGenFramebuffers(1, &depth_pyramid_fbo);
+	glGenTextures(1, &depth_pyramid);
+	glGenFramebuffers(2, deinterleave_fbos);
+	glGenFramebuffers(1, &ao_layer_fbo);
+	glGenTextures(2, layer_textures);
+	glGenTextures(1, &layer_stencil);
+	glGenFramebuffers(2, history_fbos);
+	glGenTextures(2, history_textures);
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_target_size);
+	target_width = target_height = 0;
+	shrink_countdown = 0;
+	fit_targets(false);
+	if (headless) {
+		// There may be no default framebuffer to composite into
+		glGenFramebuffers(1, &output_fbo);
+		glGenTextures(1, &output_texture);
+		glBindTexture(GL_TEXTURE_2D, output_texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, info.windowWidth, info.windowHeight);
+		glBindFramebuffer(GL_FRAMEBUFFER, output_fbo);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, output_texture, 0);
+		// For the single pass, see draw_single_pass
+		glGenRenderbuffers(1, &output_stencil);
+		glBindRenderbuffer(GL_RENDERBUFFER, output_stencil);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, info.windowWidth, info.windowHeight);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, output_stencil);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
 	glGenVertexArrays(1, &quad_vao);
 	glBindVertexArray(quad_vao);
-	object.load("../media/objects/dragon.sbm");
-	cube.load("../media/objects/cube.sbm");
+	{
+		sb7::trace::scope trace("object::load");
+		object.load(sb7::media::path("objects/dragon.sbm").c_str());
+		cube.load(sb7::media::path("objects/cube.sbm").c_str());
+	}
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
+	create_sample_points();
+}
+
+// Bytes taken by a width x height x depth texture, counting three channel
+// formats as padded to four the way most drivers store them
+static size_t texture_bytes(GLenum format, GLsizei width, GLsizei height, GLsizei depth = 1) {
+	size_t texel;
+	switch (format) {
+	case GL_R8:
+		texel = 1;
+		break;
+	case GL_RGB16F:
+	case GL_RGBA16F:
+		texel = 8;
+		break;
+	case GL_RGBA32F:
+		texel = 16;
+		break;
+	default:
+		texel = 4;
+		break;
+	}
+	return texel * width * height * depth;
+}
+
+// Fits the render targets to the framebuffer. When it outgrows them they
+// grow by at least half again, so that dragging a window edge does not
+// reallocate them on every step. A framebuffer needing less than half of
+// them in either direction only starts a countdown of SHRINK_DELAY frames,
+// after which render() calls this with shrink to fit them exactly.
+void ssao_app::fit_targets(bool shrink) {
+	sb7::trace::scope trace("fit_targets");
+	GLsizei width = target_width;
+	GLsizei height = target_height;
+
+	if (shrink) {
+		width = info.windowWidth;
+		height = info.windowHeight;
+	} else {
+		if (info.windowWidth > width)
+			width = std::max<GLsizei>(info.windowWidth, width + width / 2);
+		if (info.windowHeight > height)
+			height = std::max<GLsizei>(info.windowHeight, height + height / 2);
+		if (info.windowWidth * 2 < width || info.windowHeight * 2 < height)
+			shrink_countdown = SHRINK_DELAY;
+	}
+
+	// Multiples of 16 divide evenly down to the deinterleaved layers at
+	// quarter resolution
+	width = std::min<GLsizei>((std::max(width, 1) + 15) & ~15, max_target_size & ~15);
+	height = std::min<GLsizei>((std::max(height, 1) + 15) & ~15, max_target_size & ~15);
+	if (width == target_width && height == target_height)
+		return;
+
+	target_width = width;
+	target_height = height;
+	create_gbuffer();
+	create_ao_targets();
+}
+
+// Reads back the frame times that are available and, once enough frames
+// were measured at the current scale, moves it towards the one that would
+// take target_frame_ms. The passes it scales cost about the pixel count,
+// the square of the scale. Nothing changes while the frame time is within
+// 85-100% of the target, and a change is at most 0.1, so that the scale
+// settles rather than oscillating around the target.
+void ssao_app::update_render_scale() {
+	unsigned int tag;
+	float ms;
+
+	while (frame_timer.poll(ms, tag)) {
+		// Frames still in flight from before a change say nothing about
+		// the current scale
+		if (tag != scale_generation)
+			continue;
+		frame_ms = frame_samples ? frame_ms + (ms - frame_ms) * 0.25f : ms;
+		frame_samples++;
+	}
+
+	if (!dynamic_resolution || frame_samples < CONTROL_SAMPLES)
+		return;
+	if (frame_ms <= target_frame_ms && frame_ms >= target_frame_ms * 0.85f)
+		return;
+
+	float scale = render_scale * sqrtf(target_frame_ms * 0.925f / frame_ms);
+	scale = std::min(std::max(scale, render_scale - 0.1f), render_scale + 0.1f);
+	scale = std::min(std::max(scale, min_render_scale), max_render_scale);
+	if (fabsf(scale - render_scale) < 0.01f)
+		return;
+
+	printf("Render scale %.2f -> %.2f (%.1f ms, target %.1f ms)\n", render_scale, scale, frame_ms, target_frame_ms);
+	set_render_scale(scale);
+}
+
+void ssao_app::set_render_scale(float scale) {
+	render_scale = scale;
+	scale_generation++;
+	frame_samples = 0;
+	history_valid = false;
+}
+
+// The settings the quality governor moves between, cheapest first. The
+// cost of the occlusion pass goes with the number of taps, points times
+// steps, which grows by a third to a half from one level to the next.
+static const struct {
+	unsigned int points;
+	unsigned int steps;
+} quality_levels[] = {
+	{ 2, 2 }, { 3, 2 }, { 4, 2 }, { 4, 3 }, { 6, 3 }, { 6, 4 }, { 8, 4 }, { 12, 4 },
+	{ 16, 4 }, { 24, 4 }, { 32, 4 }, { 32, 6 }, { 48, 6 }, { 64, 6 }, { 64, 8 }
+};
+static const int QUALITY_LEVELS = sizeof(quality_levels) / sizeof(quality_levels[0]);
+
+// Starts the governor from the most expensive level that does not cost more
+// than the current settings
+void ssao_app::start_governor() {
+	int level = 0;
+	while (level + 1 < QUALITY_LEVELS &&
+		   quality_levels[level + 1].points * quality_levels[level + 1].steps <= point_count * step_count)
+		level++;
+	set_quality_level(level);
+}
+
+void ssao_app::set_quality_level(int level) {
+	quality_level = level;
+	point_count = quality_levels[level].points;
+	step_count = quality_levels[level].steps;
+	quality_generation++;
+	ao_samples = 0;
+}
+
+// Reads back the occlusion times that are available and, once enough frames
+// were measured at the current level, drops as many levels as the cost model
+// says it takes to get back under the budget, or raises it by one. A level
+// is only raised to while its predicted time fits in 90% of the budget, so
+// that it does not flip straight back.
+void ssao_app::govern_quality() {
+	unsigned int tag;
+	float ms;
+
+	while (ao_timer.poll(ms, tag)) {
+		if (tag != quality_generation)
+			continue;
+		ao_ms = ao_samples ? ao_ms + (ms - ao_ms) * 0.25f : ms;
+		ao_samples++;
+	}
+
+	if (!quality_governor || ao_samples < CONTROL_SAMPLES)
+		return;
+
+	const float cost = (float)(point_count * step_count);
+	auto predicted = [&](int level) {
+		return ao_ms * (quality_levels[level].points * quality_levels[level].steps) / cost;
+	};
+	int level = quality_level;
+	if (ao_ms > ao_budget_ms) {
+		while (level > 0 && (level == quality_level || predicted(level) > ao_budget_ms * 0.9f))
+			level--;
+	} else if (level + 1 < QUALITY_LEVELS && predicted(level + 1) <= ao_budget_ms * 0.9f) {
+		level++;
+	}
+	if (level == quality_level)
+		return;
+
+	printf("Quality %u points x %u steps -> %u x %u (occlusion %.2f ms, budget %.2f ms)\n",
+		   point_count, step_count, quality_levels[level].points, quality_levels[level].steps, ao_ms, ao_budget_ms);
+	set_quality_level(level);
+}
 
+// Prints how much memory the render targets take
+void ssao_app::report_target_memory() const {
+	printf("Render targets %dx%d: %.1f MB (G-buffer %.1f MB, occlusion %.1f MB)\n",
+		   (int)target_width, (int)target_height, (gbuffer_bytes + ao_target_bytes) / 1048576.0,
+		   gbuffer_bytes / 1048576.0, ao_target_bytes / 1048576.0);
+}
+
+// (Re)allocates the G-buffer at the target size, its color and normal
+// targets in the layout compact_gbuffer selects, and attaches it to
+// render_fbo
+void ssao_app::create_gbuffer() {
+	const GLenum formats[] = { GLenum(compact_gbuffer ? GL_RGB10_A2 : GL_RGB16F),
+							   GLenum(compact_gbuffer ? GL_RG16 : GL_RGBA32F),
+							   GL_DEPTH24_STENCIL8,
+							   GL_RGBA16F };
+	static const GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+										  GL_DEPTH_STENCIL_ATTACHMENT, GL_COLOR_ATTACHMENT2 };
+	int i;
+
+	glDeleteTextures(4, fbo_textures);
+	glGenTextures(4, fbo_textures);
+	glBindFramebuffer(GL_FRAMEBUFFER, render_fbo);
+	gbuffer_bytes = 0;
+	for (i = 0; i < 4; i++) {
+		glBindTexture(GL_TEXTURE_2D, fbo_textures[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, formats[i], target_width, target_height);
+		// The composite filters the color when it scales it up
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, i == 0 ? GL_LINEAR : GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, i == 0 ? GL_LINEAR : GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glFramebufferTexture(GL_FRAMEBUFFER, attachments[i], fbo_textures[i], 0);
+		gbuffer_bytes += texture_bytes(formats[i], target_width, target_height);
+	}
+}
+
+// Uploads the sample kernel and the noise texture. The kernel and blue noise
+// are read from a cache beside the executable when an earlier run already
+// generated them; the blue noise in particular takes a moment to make.
+void ssao_app::create_sample_points() {
+	sb7::trace::scope trace("create_sample_points");
+	using namespace sb7::sample_kernel;
+	const unsigned int version = 1;
 	int i;
 	SAMPLE_POINTS point_data;
 
-	for (i = 0; i < 256; i++) {
-		do {
-			point_data.point[i][0] = random_float() * 2.0f - 1.0f;
-			point_data.point[i][1] = random_float() * 2.0f - 1.0f;
-			point_data.point[i][2] = random_float(); //  * 2.0f - 1.0f;
-			point_data.point[i][3] = 0.0f;
-		} while (length(point_data.point[i]) > 1.0f);
-		normalize(point_data.point[i]);
-	}
-	for (i = 0; i < 256; i++) {
-		point_data.random_vectors[i][0] = random_float();
-		point_data.random_vectors[i][1] = random_float();
-		point_data.random_vectors[i][2] = random_float();
-		point_data.random_vectors[i][3] = random_float();
+	char name[64];
+	unsigned int falloff = (unsigned int)(kernel_falloff * 100.0f + 0.5f);
+	snprintf(name, sizeof(name), "samples_%s_%u.cache", names[kernel], falloff);
+	std::string filename = sb7::media::build_path(name);
+	unsigned int tag = version << 24 | falloff << 8 | kernel;
+	if (!load(filename, tag, &point_data, sizeof(point_data))) {
+		generate(kernel, (float (*)[4])&point_data.point[0], 256, falloff / 100.0f);
+		for (i = 0; i < 256; i++) {
+			point_data.random_vectors[i][0] = random_float();
+			point_data.random_vectors[i][1] = random_float();
+			point_data.random_vectors[i][2] = random_float();
+			point_data.random_vectors[i][3] = random_float();
+		}
+		store(filename, tag, &point_data, sizeof(point_data));
 	}
 	glGenBuffers(1, &points_buffer);
 	glBindBuffer(GL_UNIFORM_BUFFER, points_buffer);
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(SAMPLE_POINTS), &point_data, GL_STATIC_DRAW);
+
+	// Two independent tiles for the two components the passes use
+	static unsigned char texels[NOISE_SIZE * NOISE_SIZE * 2];
+	if (blue_noise) {
+		filename = sb7::media::build_path("blue_noise.cache");
+		if (!load(filename, version << 8 | NOISE_SIZE, texels, sizeof(texels))) {
+			sb7::sample_kernel::blue_noise(texels, NOISE_SIZE, 2, 0x13371337);
+			sb7::sample_kernel::blue_noise(texels + 1, NOISE_SIZE, 2, 0x7f4a7c15);
+			store(filename, version << 8 | NOISE_SIZE, texels, sizeof(texels));
+		}
+	} else {
+		white_noise(texels, NOISE_SIZE * NOISE_SIZE * 2, 1, 0x13371337);
+	}
+	glGenTextures(1, &noise_texture);
+	glBindTexture(GL_TEXTURE_2D, noise_texture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG8, NOISE_SIZE, NOISE_SIZE);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, NOISE_SIZE, NOISE_SIZE, GL_RG, GL_UNSIGNED_BYTE, texels);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glActiveTexture(GL_TEXTURE7);
+	glBindTexture(GL_TEXTURE_2D, noise_texture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// Accepts the options below, described in README.md, and returns false
+// after printing the usage for anything else:
+//   --kernel <name>, --falloff <0-0.9>, --blue-noise   sample kernel
+//   --target-ms, --min-scale, --max-scale              dynamic resolution
+//   --ao-budget-ms                                     quality governor
+//   --profile, --trace <file>                          GPU and CPU timing
+//   --size <w>x<h>, --headless, --capture <file>       output
+//   --benchmark and its options                        see run_benchmark
+//   --golden and its options                           see run_golden
+bool ssao_app::parse_arguments(int argc, char ** argv) {
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc && sb7::sample_kernel::parse(argv[i + 1], kernel)) {
+			i++;
+		} else if (strcmp(argv[i], "--falloff") == 0 && i + 1 < argc) {
+			kernel_falloff = fminf(fmaxf((float)atof(argv[++i]), 0.0f), 0.9f);
+		} else if (strcmp(argv[i], "--blue-noise") == 0) {
+			blue_noise = true;
+		} else if (strcmp(argv[i], "--target-ms") == 0 && i + 1 < argc) {
+			target_frame_ms = fmaxf((float)atof(argv[++i]), 0.1f);
+			dynamic_resolution = true;
+		} else if (strcmp(argv[i], "--min-scale") == 0 && i + 1 < argc) {
+			min_render_scale = fminf(fmaxf((float)atof(argv[++i]), 0.25f), 1.0f);
+		} else if (strcmp(argv[i], "--max-scale") == 0 && i + 1 < argc) {
+			max_render_scale = fminf(fmaxf((float)atof(argv[++i]), 0.25f), 1.0f);
+		} else if (strcmp(argv[i], "--profile") == 0) {
+			profiling = true;
+		} else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+			capture_pattern = argv[++i];
+			capturing = true;
+		} else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+			golden_dir = argv[++i];
+		} else if (strcmp(argv[i], "--golden-update") == 0) {
+			golden_update = true;
+		} else if (strcmp(argv[i], "--min-psnr") == 0 && i + 1 < argc) {
+			golden_min_psnr = (float)atof(argv[++i]);
+		} else if (strcmp(argv[i], "--min-ssim") == 0 && i + 1 < argc) {
+			golden_min_ssim = (float)atof(argv[++i]);
+		} else if (strcmp(argv[i], "--time-tolerance") == 0 && i + 1 < argc) {
+			golden_time_tolerance = fmaxf((float)atof(argv[++i]), 0.0f);
+		} else if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+		} else if (strcmp(argv[i], "--benchmark") == 0) {
+			benchmark = true;
+		} else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+			benchmark_warmup = std::max(atoi(argv[++i]), 0);
+		} else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			benchmark_frames = std::max(atoi(argv[++i]), 1);
+		} else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc && parse_sweep(argv[i + 1])) {
+			i++;
+		} else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+			benchmark_csv = argv[++i];
+		} else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc &&
+				   sscanf(argv[i + 1], "%dx%d", &requested_width, &requested_height) == 2 &&
+				   requested_width > 0 && requested_height > 0) {
+			i++;
+		} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			trace_filename = argv[++i];
+			sb7::trace::enable(true);
+		} else if (strcmp(argv[i], "--ao-budget-ms") == 0 && i + 1 < argc) {
+			ao_budget_ms = fmaxf((float)atof(argv[++i]), 0.05f);
+			quality_governor = true;
+		} else {
+			fprintf(stderr, "usage: %s [--kernel random|poisson|halton|hammersley|cosine] [--falloff 0-0.9] [--blue-noise]\n"
+							"       [--target-ms ms] [--min-scale 0.25-1] [--max-scale 0.25-1] [--ao-budget-ms ms]\n"
+							"       [--profile] [--trace file.json] [--size WxH] [--headless [--frames n]]\n"
+							"       [--capture frame%%05d.png|frame%%05d.ppm|stream.raw]\n"
+							"       [--golden dir [--golden-update] [--min-psnr dB] [--min-ssim 0-1] [--time-tolerance 0.25]]\n"
+							"       [--benchmark [--warmup n] [--frames n] [--csv file] [--sweep points|steps|radius|scale|ao_scale=v,v,...]...]\n", argv[0]);
+			return false;
+		}
+	}
+	min_render_scale = fminf(min_render_scale, max_render_scale);
+	return true;
 }
 
 void ssao_app::render(double currentTime) {
+	sb7::trace::scope trace("render");
 	static const GLfloat black[] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	static const GLfloat one = 1.0f;
-	static double last_time = 0.0;
-	static double total_time = 0.0;
 
 	if (!paused)
 		total_time += (currentTime - last_time);
@@ -252,70 +1094,1097 @@ void ssao_app::render(double currentTime) {
 
 	auto f = (float)total_time;
 
-	glViewport(0, 0, info.windowWidth, info.windowHeight);
+	if (shrink_countdown && --shrink_countdown == 0)
+		fit_targets(true);
+	update_render_scale();
+	govern_quality();
+	profiler.update();
+	render_width = std::max(1, (int)(info.windowWidth * render_scale + 0.5f));
+	render_height = std::max(1, (int)(info.windowHeight * render_scale + 0.5f));
+
+	{
+		sb7::trace::scope trace("programs");
+		programs.update();
+		select_programs();
+	}
+	{
+		// Waits for the GPU when it is more than a few frames behind
+		sb7::trace::scope trace("uniform_ring::begin_frame");
+		uniform_ring.begin_frame();
+	}
+
+	vmath::vec3 eye(0.0f, 3.0f, 15.0f);
+	if (camera_path) {
+		eye[1] += 2.0f * sinf(f * 0.7f);
+		eye[2] -= 6.0f * sinf(f * 0.4f);
+	}
+	const vmath::mat4 lookat_matrix = vmath::lookat(eye,
+                                      vmath::vec3(0.0f, 0.0f, 0.0f),
+                                      vmath::vec3(0.0f, 1.0f, 0.0f));
+
+	FRAME frame;
+	frame.proj_matrix = vmath::perspective(50.0f, (float)info.windowWidth / (float)info.windowHeight, 0.1f, 1000.0f);
+	frame.prev_proj_matrix = frame_index ? prev_proj_matrix : frame.proj_matrix;
+	frame.viewport_size[0] = (float)render_width;
+	frame.viewport_size[1] = (float)render_height;
+	frame.target_size[0] = (float)target_width;
+	frame.target_size[1] = (float)target_height;
+	frame.output_size[0] = (float)info.windowWidth;
+	frame.output_size[1] = (float)info.windowHeight;
+	uniform_ring.bind(FRAME_BINDING, frame);
+	prev_proj_matrix = frame.proj_matrix;
+	GEOMETRY_PASS geometry_pass;
+	geometry_pass.shading_level = show_shading ? (show_ao ? 0.7f : 1.0f) : 0.0f;
+	uniform_ring.bind(GEOMETRY_PASS_BINDING, geometry_pass);
+
+	// The first frame pays for one-time uploads and is not measured
+	bool measure_frame = dynamic_resolution && frame_index > 0;
+	bool measure_ao = quality_governor && frame_index > 0;
+	if (measure_frame)
+		frame_timer.begin(scale_generation);
+	if (profiling)
+		profiler.begin(PROFILE_GEOMETRY);
+
+	glViewport(0, 0, render_width, render_height);
 	glBindFramebuffer(GL_FRAMEBUFFER, render_fbo);
 	glEnable(GL_DEPTH_TEST);
 	glClearBufferfv(GL_COLOR, 0, black);
 	glClearBufferfv(GL_COLOR, 1, black);
-	glClearBufferfv(GL_DEPTH, 0, &one);
-	glBindBufferBase(GL_UNIFORM_BUFFER, 0, points_buffer);
+	glClearBufferfv(GL_COLOR, 2, black);
+	glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+	glEnable(GL_STENCIL_TEST);
+	glStencilFunc(GL_ALWAYS, 1, 0xff);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+	glBindBufferBase(GL_UNIFORM_BUFFER, SAMPLE_POINTS_BINDING, points_buffer);
 	glUseProgram(render_program);
 
-	const vmath::mat4 lookat_matrix = vmath::lookat(vmath::vec3(0.0f, 3.0f, 15.0f),
-                                      vmath::vec3(0.0f, 0.0f, 0.0f),
-                                      vmath::vec3(0.0f, 1.0f, 0.0f));
-
-	vmath::mat4 proj_matrix = vmath::perspective(50.0f, (float)info.windowWidth / (float)info.windowHeight, 0.1f, 1000.0f);
-	glUniformMatrix4fv(uniforms.render.proj_matrix, 1, GL_FALSE, proj_matrix);
-	vmath::mat4 mv_matrix = vmath::translate(0.0f, -5.0f, 0.0f) *
+	OBJECT object_data;
+	object_data.mv_matrix = lookat_matrix *
+							vmath::translate(0.0f, -5.0f, 0.0f) *
 							vmath::rotate(f * 5.0f, 0.0f, 1.0f, 0.0f) *
 							vmath::mat4::identity();
-	glUniformMatrix4fv(uniforms.render.mv_matrix, 1, GL_FALSE, lookat_matrix * mv_matrix);
-	glUniform1f(uniforms.render.shading_level, show_shading ? (show_ao ? 0.7f : 1.0f) : 0.0f);
+	object_data.prev_mv_matrix = frame_index ? prev_mv_matrices[0] : object_data.mv_matrix;
+	prev_mv_matrices[0] = object_data.mv_matrix;
+	uniform_ring.bind(OBJECT_BINDING, object_data);
 	object.render();
-	mv_matrix = vmath::translate(0.0f, -4.5f, 0.0f) *
-		vmath::rotate(f * 5.0f, 0.0f, 1.0f, 0.0f) *
-		vmath::scale(4000.0f, 0.1f, 4000.0f) *
-		vmath::mat4::identity();
-	glUniformMatrix4fv(uniforms.render.mv_matrix, 1, GL_FALSE, lookat_matrix * mv_matrix);
+	object_data.mv_matrix = lookat_matrix *
+							vmath::translate(0.0f, -4.5f, 0.0f) *
+							vmath::rotate(f * 5.0f, 0.0f, 1.0f, 0.0f) *
+							vmath::scale(4000.0f, 0.1f, 4000.0f) *
+							vmath::mat4::identity();
+	object_data.prev_mv_matrix = frame_index ? prev_mv_matrices[1] : object_data.mv_matrix;
+	prev_mv_matrices[1] = object_data.mv_matrix;
+	uniform_ring.bind(OBJECT_BINDING, object_data);
 	cube.render();
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glUseProgram(ssao_program);
-	glUniform1f(uniforms.ssao.ssao_radius, ssao_radius * float(info.windowWidth) / 1000.0f);
-	glUniform1f(uniforms.ssao.ssao_level, show_ao ? (show_shading ? 0.3f : 1.0f) : 0.0f);
-	glUniform1i(uniforms.ssao.randomize_points, randomize_points ? 1 : 0);
-	glUniform1ui(uniforms.ssao.point_count, point_count);
+	glDisable(GL_STENCIL_TEST);
+	if (profiling)
+		profiler.end(PROFILE_GEOMETRY);
+
+	SSAO_PASS ssao_pass;
+	ssao_pass.ssao_level = show_ao ? (show_shading ? 0.3f : 1.0f) : 0.0f;
+	ssao_pass.object_level = 1.0f;
+	ssao_pass.ssao_radius = pass_radius();
+	ssao_pass.point_count = point_count;
+	ssao_pass.step_count = step_count;
+	ssao_pass.randomize_points = randomize_points ? 1 : 0;
+	ssao_pass.weight_by_angle = weight_by_angle ? 1 : 0;
+	ssao_pass.point_offset = temporal_ao ? (frame_index * point_count) % 256 : 0;
+	ssao_pass.history_weight = history_valid ? 0.875f : 0.0f;
+	uniform_ring.bind(SSAO_PASS_BINDING, ssao_pass);
+
+	// Fall back to the single pass until the split pipeline's programs are built
+	bool split = (split_passes || ao_scale > 1) && split_programs_ready();
+
+	glDisable(GL_DEPTH_TEST);
+	glBindVertexArray(quad_vao);
+	if (profiling && split)
+		profiler.begin(PROFILE_OCCLUSION);
+	if (split)
+		render_ao();
+	if (profiling && split)
+		profiler.end(PROFILE_OCCLUSION);
+
+	glViewport(0, 0, info.windowWidth, info.windowHeight);
+	glBindFramebuffer(GL_FRAMEBUFFER, output_fbo);
+	glUseProgram(split ? composite_program : ssao_program);
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, fbo_textures[0]);
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, fbo_textures[1]);
-	glDisable(GL_DEPTH_TEST);
-	glBindVertexArray(quad_vao);
+	glActiveTexture(GL_TEXTURE8);
+	glBindTexture(GL_TEXTURE_2D, fbo_textures[2]);
+	if (measure_ao && !split)
+		ao_timer.begin(quality_generation);
+	if (profiling)
+		profiler.begin(split ? PROFILE_COMPOSITE : PROFILE_OCCLUSION);
+	if (split)
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	else
+		draw_single_pass();
+	if (profiling)
+		profiler.end(split ? PROFILE_COMPOSITE : PROFILE_OCCLUSION);
+	if (measure_ao && !split)
+		ao_timer.end();
+	if (measure_frame)
+		frame_timer.end();
+	if (capturing) {
+		sb7::trace::scope trace("capture");
+		capture.capture(output_fbo, info.windowWidth, info.windowHeight, captured_frames++);
+	}
+	if (!capture_pattern.empty())
+		capture.update();
+	uniform_ring.end_frame();
+	frame_index++;
+}
+
+// Occlusion only passes. Below full resolution one normal and depth is
+// picked per block of ao_scale x ao_scale pixels first and the sample loop
+// runs on those. The occlusion is accumulated over frames into the
+// history, then blurred horizontally into ao_textures[2] and vertically
+// into ao_textures[1]. Leaves the textures the composite reads bound to
+// units 2, 3 and 9. The normal and depth the passes read are on unit 1 and
+// their depth buffer on unit 8; the passes only sample it with
+// compact_gbuffer.
+void ssao_app::render_ao() {
+	sb7::trace::scope trace("render_ao");
+	GLuint normal_depth = fbo_textures[1];
+	GLuint depth_buffer = fbo_textures[2];
+	GLsizei width = (render_width + ao_scale - 1) / ao_scale;
+	GLsizei height = (render_height + ao_scale - 1) / ao_scale;
+
+	// The targets are sized for the largest window; keep the clears to the
+	// part in use
+	glViewport(0, 0, width, height);
+	glScissor(0, 0, width, height);
+	glEnable(GL_SCISSOR_TEST);
+	glActiveTexture(GL_TEXTURE1);
+	if (ao_scale > 1) {
+		static const GLfloat zero[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		glBindFramebuffer(GL_FRAMEBUFFER, ao_fbos[0]);
+		glClearBufferfv(GL_COLOR, 0, zero);
+		glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+		glEnable(GL_STENCIL_TEST);
+		glStencilFunc(GL_ALWAYS, 1, 0xff);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		if (compact_gbuffer) {
+			glEnable(GL_DEPTH_TEST);
+			glDepthFunc(GL_ALWAYS);
+		}
+		glUseProgram(downsample_program);
+		glBindTexture(GL_TEXTURE_2D, fbo_textures[1]);
+		glActiveTexture(GL_TEXTURE8);
+		glBindTexture(GL_TEXTURE_2D, fbo_textures[2]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glDepthFunc(GL_LESS);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_STENCIL_TEST);
+		normal_depth = ao_textures[0];
+		depth_buffer = ao_depth_stencil;
+	}
+	glActiveTexture(GL_TEXTURE8);
+	glBindTexture(GL_TEXTURE_2D, depth_buffer);
+	glActiveTexture(GL_TEXTURE1);
+	// The quality governor times the occlusion itself, as the passes around
+	// it cost the same whatever the quality
+	bool measure = quality_governor && frame_index > 0;
+	if (measure)
+		ao_timer.begin(quality_generation);
+	if (ao_path == AO_PATH_DEINTERLEAVED) {
+		render_ao_layers(normal_depth, width, height);
+	} else if (ao_path == AO_PATH_COMPUTE) {
+		glUseProgram(ao_program);
+		glBindTexture(GL_TEXTURE_2D, normal_depth);
+		glBindImageTexture(0, ao_textures[1], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8);
+		glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	} else {
+		if (ao_path == AO_PATH_DEPTH_MIPS) {
+			build_depth_pyramid(normal_depth, width, height);
+			glViewport(0, 0, width, height);
+			glActiveTexture(GL_TEXTURE1);
+		}
+		glBindTexture(GL_TEXTURE_2D, normal_depth);
+		draw_covered(ao_scale > 1 ? ao_fbos[0] : render_fbo, width, height);
+	}
+	if (measure)
+		ao_timer.end();
+
+	glActiveTexture(GL_TEXTURE9);
+	glBindTexture(GL_TEXTURE_2D, depth_buffer);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, normal_depth);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, ao_textures[1]);
+	if (temporal_ao) {
+		glActiveTexture(GL_TEXTURE5);
+		glBindTexture(GL_TEXTURE_2D, fbo_textures[3]);
+		glActiveTexture(GL_TEXTURE6);
+		glBindTexture(GL_TEXTURE_2D, history_textures[history_index]);
+		history_index ^= 1;
+		glBindFramebuffer(GL_FRAMEBUFFER, history_fbos[history_index]);
+		glUseProgram(temporal_program);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, history_textures[history_index]);
+	}
+	history_valid = temporal_ao;
+	if (blur_ao) {
+		glBindFramebuffer(GL_FRAMEBUFFER, ao_fbos[2]);
+		glUseProgram(blur_programs[0]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glBindTexture(GL_TEXTURE_2D, ao_textures[2]);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, ao_fbos[1]);
+		glUseProgram(blur_programs[1]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glBindTexture(GL_TEXTURE_2D, ao_textures[1]);
+	}
+	glDisable(GL_SCISSOR_TEST);
+}
+
+// Runs ao_program over the pixels of the bound normal and depth that hold
+// geometry, drawing into ao_fbos[1] with the stencil copied from
+// stencil_fbo. The rest is cleared to unoccluded.
+void ssao_app::draw_covered(GLuint stencil_fbo, GLsizei width, GLsizei height) {
+	static const GLfloat unoccluded[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, stencil_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ao_fbos[1]);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, ao_fbos[1]);
+	glClearBufferfv(GL_COLOR, 0, unoccluded);
+	glEnable(GL_STENCIL_TEST);
+	glStencilFunc(GL_EQUAL, 1, 0xff);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	glUseProgram(ao_program);
+	bool counting = begin_coverage();
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	end_coverage(counting, width * height);
+	glDisable(GL_STENCIL_TEST);
+}
+
+// Runs the bound ssao_program over the pixels of the bound framebuffer
+// that hold geometry. There is no stencil from the geometry pass at the
+// framebuffer's size, so ssao_background_program shades the rest first
+// and clears their stencil. Until it is built, or if the framebuffer has
+// no stencil, every pixel runs ssao_program.
+void ssao_app::draw_single_pass() {
+	static const GLint geometry = 1;
+
+	if (ssao_background_program) {
+		glClearBufferiv(GL_STENCIL, 0, &geometry);
+		glEnable(GL_STENCIL_TEST);
+		glStencilFunc(GL_ALWAYS, 0, 0xff);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		glUseProgram(ssao_background_program);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glStencilFunc(GL_EQUAL, 1, 0xff);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+		glUseProgram(ssao_program);
+	}
+	bool counting = begin_coverage();
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	end_coverage(counting, info.windowWidth * info.windowHeight);
+	glDisable(GL_STENCIL_TEST);
+}
+
+// Starts counting the samples the occlusion passes shade, unless the last
+// count is still in flight, and returns whether it did
+bool ssao_app::begin_coverage() {
+	update_coverage();
+	if (coverage_pending)
+		return false;
+	glBeginQuery(GL_SAMPLES_PASSED, coverage_query);
+	return true;
+}
+
+// Ends the count begin_coverage started, out of total pixels
+void ssao_app::end_coverage(bool counting, GLuint total) {
+	if (!counting)
+		return;
+	glEndQuery(GL_SAMPLES_PASSED);
+	coverage_total = total;
+	coverage_pending = true;
+}
+
+// Reads back the last count of coverage_query into skipped_pixels once it
+// is available
+void ssao_app::update_coverage() {
+	GLuint covered;
+
+	if (!coverage_pending)
+		return;
+	glGetQueryObjectuiv(coverage_query, GL_QUERY_RESULT_AVAILABLE, &covered);
+	if (!covered)
+		return;
+	glGetQueryObjectuiv(coverage_query, GL_QUERY_RESULT, &covered);
+	skipped_pixels = 100.0f - (100.0f * covered) / coverage_total;
+	coverage_pending = false;
+	if (window) {
+		char title[sizeof(info.title) + 64];
+		snprintf(title, sizeof(title), "%s - occlusion skipped on %d%% of pixels", info.title, (int)skipped_pixels);
+		glfwSetWindowTitle(window, title);
+	}
+}
+
+// Prints the GPU profile and the share of pixels the occlusion skipped
+void ssao_app::report_profile() {
+	profiler.report(stdout);
+	if (skipped_pixels >= 0.0f)
+		printf("Occlusion skipped on %.1f%% of pixels\n", skipped_pixels);
+}
+
+// Splits normal_depth into layer_textures[0] in two passes of eight
+// layers, runs the occlusion pass on each layer into layer_textures[1] and
+// interleaves the result into ao_textures[1]. As in draw_single_pass,
+// ao_background_program first shades the background of every layer and
+// clears its stencil in layer_stencil, so that only texels holding
+// geometry run ao_program.
+void ssao_app::render_ao_layers(GLuint normal_depth, GLsizei width, GLsizei height) {
+	static const GLint geometry = 1;
+	const GLsizei layer_width = (width + 3) / 4, layer_height = (height + 3) / 4;
+	int i;
+
+	glViewport(0, 0, layer_width, layer_height);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, normal_depth);
+	for (i = 0; i < 2; i++) {
+		glBindFramebuffer(GL_FRAMEBUFFER, deinterleave_fbos[i]);
+		glUseProgram(deinterleave_programs[i]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, layer_textures[0]);
+	glBindFramebuffer(GL_FRAMEBUFFER, ao_layer_fbo);
+	if (ao_background_program) {
+		glEnable(GL_STENCIL_TEST);
+		glStencilFunc(GL_ALWAYS, 0, 0xff);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		glUseProgram(ao_background_program);
+		for (i = 0; i < AO_LAYERS; i++) {
+			bind_ao_layer(i);
+			glClearBufferiv(GL_STENCIL, 0, &geometry);
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		}
+		glStencilFunc(GL_EQUAL, 1, 0xff);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	}
+	glUseProgram(ao_program);
+	bool counting = begin_coverage();
+	for (i = 0; i < AO_LAYERS; i++) {
+		bind_ao_layer(i);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+	end_coverage(counting, AO_LAYERS * layer_width * layer_height);
+	glDisable(GL_STENCIL_TEST);
+
+	glViewport(0, 0, width, height);
+	glBindFramebuffer(GL_FRAMEBUFFER, ao_fbos[1]);
+	glUseProgram(reinterleave_program);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, layer_textures[1]);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glActiveTexture(GL_TEXTURE1);
+}
+
+// Directs the occlusion pass at layer i of the deinterleaved targets
+void ssao_app::bind_ao_layer(int i) {
+	AO_LAYER layer;
+	layer.offset[0] = i & 3;
+	layer.offset[1] = i >> 2;
+	layer.index = i;
+	layer.padding = 0;
+	uniform_ring.bind(AO_LAYER_BINDING, layer);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layer_textures[1], 0, i);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, layer_stencil, 0, i);
+}
+
+// Copies the depth of normal_depth into the first level of depth_pyramid
+// and fills each further level from the one before it, which is selected
+// as the only level that can be sampled while the next one is rendered.
+// Leaves the pyramid bound to texture unit 4.
+void ssao_app::build_depth_pyramid(GLuint normal_depth, GLsizei width, GLsizei height) {
+	int level;
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, normal_depth);
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_2D, depth_pyramid);
+	glBindFramebuffer(GL_FRAMEBUFFER, depth_pyramid_fbo);
+	for (level = 0; level < DEPTH_MIP_LEVELS; level++) {
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, depth_pyramid, level);
+		glViewport(0, 0, width, height);
+		if (level == 0) {
+			glUseProgram(depth_mip_programs[0]);
+		} else {
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+			glUseProgram(depth_mip_programs[1]);
+		}
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, DEPTH_MIP_LEVELS - 1);
+}
+
+// (Re)allocates the occlusion targets for the current target size, ao_scale
+// and G-buffer layout, and reports the memory all targets take. At full
+// resolution the G-buffer's normal and depth are used directly.
+void ssao_app::create_ao_targets() {
+	const GLenum formats[] = { GLenum(compact_gbuffer ? GL_RG16 : GL_RGBA32F), GL_R8, GL_R8 };
+	static const GLenum layer_formats[] = { GL_RGBA32F, GL_R8 };
+	static const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3,
+										   GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5, GL_COLOR_ATTACHMENT6, GL_COLOR_ATTACHMENT7 };
+	const GLsizei width = target_width / ao_scale;
+	const GLsizei height = target_height / ao_scale;
+	int i, j;
+
+	ao_target_bytes = 0;
+	glDeleteTextures(3, ao_textures);
+	glGenTextures(3, ao_textures);
+	for (i = ao_scale > 1 ? 0 : 1; i < 3; i++) {
+		glBindTexture(GL_TEXTURE_2D, ao_textures[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, formats[i], width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindFramebuffer(GL_FRAMEBUFFER, ao_fbos[i]);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, ao_textures[i], 0);
+		ao_target_bytes += texture_bytes(formats[i], width, height);
+	}
+
+	// The occlusion pass is masked by the geometry pass's stencil at full
+	// resolution and by the one the downsample pass writes below it, either
+	// copied into ao_stencil, which has the same format for the blit
+	glDeleteRenderbuffers(1, &ao_stencil);
+	glGenRenderbuffers(1, &ao_stencil);
+	glBindRenderbuffer(GL_RENDERBUFFER, ao_stencil);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	ao_target_bytes += texture_bytes(GL_DEPTH24_STENCIL8, width, height);
+	glBindFramebuffer(GL_FRAMEBUFFER, ao_fbos[1]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, ao_stencil);
+	glDeleteTextures(1, &ao_depth_stencil);
+	glGenTextures(1, &ao_depth_stencil);
+	if (ao_scale > 1) {
+		glBindTexture(GL_TEXTURE_2D, ao_depth_stencil);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, width, height);
+		ao_target_bytes += texture_bytes(GL_DEPTH24_STENCIL8, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindFramebuffer(GL_FRAMEBUFFER, ao_fbos[0]);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, ao_depth_stencil, 0);
+	}
+
+	glDeleteTextures(1, &depth_pyramid);
+	glGenTextures(1, &depth_pyramid);
+	glBindTexture(GL_TEXTURE_2D, depth_pyramid);
+	glTexStorage2D(GL_TEXTURE_2D, DEPTH_MIP_LEVELS, GL_R32F, width, height);
+	for (i = 0; i < DEPTH_MIP_LEVELS; i++)
+		ao_target_bytes += texture_bytes(GL_R32F, std::max(width >> i, 1), std::max(height >> i, 1));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glDeleteTextures(2, history_textures);
+	glGenTextures(2, history_textures);
+	for (i = 0; i < 2; i++) {
+		glBindTexture(GL_TEXTURE_2D, history_textures[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, history_fbos[i]);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, history_textures[i], 0);
+		ao_target_bytes += texture_bytes(GL_RGBA16F, width, height);
+	}
+	history_valid = false;
+
+	glDeleteTextures(2, layer_textures);
+	glGenTextures(2, layer_textures);
+	for (i = 0; i < 2; i++) {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, layer_textures[i]);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, layer_formats[i], width / 4, height / 4, AO_LAYERS);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		ao_target_bytes += texture_bytes(layer_formats[i], width / 4, height / 4, AO_LAYERS);
+	}
+	glDeleteTextures(1, &layer_stencil);
+	glGenTextures(1, &layer_stencil);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, layer_stencil);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH24_STENCIL8, width / 4, height / 4, AO_LAYERS);
+	ao_target_bytes += texture_bytes(GL_DEPTH24_STENCIL8, width / 4, height / 4, AO_LAYERS);
+	for (i = 0; i < 2; i++) {
+		glBindFramebuffer(GL_FRAMEBUFFER, deinterleave_fbos[i]);
+		for (j = 0; j < 8; j++)
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + j, layer_textures[0], 0, i * 8 + j);
+		glDrawBuffers(8, draw_buffers);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	report_target_memory();
+}
+
+// Whether everything the split occlusion passes need is built
+bool ssao_app::split_programs_ready() const {
+	if (!ao_program || !composite_program)
+		return false;
+	if (ao_scale > 1 && !downsample_program)
+		return false;
+	if (blur_ao && !(blur_programs[0] && blur_programs[1]))
+		return false;
+	if (temporal_ao && !temporal_program)
+		return false;
+	if (ao_path == AO_PATH_DEINTERLEAVED)
+		return deinterleave_programs[0] && deinterleave_programs[1] && reinterleave_program;
+	if (ao_path == AO_PATH_DEPTH_MIPS)
+		return depth_mip_programs[0] && depth_mip_programs[1];
+	return true;
+}
+
+// Writes the CPU trace recorded so far to trace_filename
+void ssao_app::write_trace() {
+	if (sb7::trace::write(trace_filename))
+		printf("Trace written to %s\n", trace_filename.c_str());
+	else
+		fprintf(stderr, "Failed to write trace to %s\n", trace_filename.c_str());
+}
+
+static const char * const sweep_names[] = { "points", "steps", "radius", "scale", "ao_scale" };
+
+// Parses a --sweep argument, name=value,value,...
+bool ssao_app::parse_sweep(const char * arg) {
+	sweep s;
+	const char * values = strchr(arg, '=');
+	if (!values)
+		return false;
+	for (s.parameter = 0; s.parameter < SWEEP_PARAMETERS; s.parameter++) {
+		if (strlen(sweep_names[s.parameter]) == size_t(values - arg) &&
+			strncmp(arg, sweep_names[s.parameter], values - arg) == 0)
+			break;
+	}
+	if (s.parameter == SWEEP_PARAMETERS)
+		return false;
+	for (const char * p = values + 1; *p; ) {
+		char * end;
+		s.values.push_back(strtof(p, &end));
+		if (end == p || (*end && *end != ','))
+			return false;
+		p = *end ? end + 1 : end;
+	}
+	if (s.values.empty())
+		return false;
+	sweeps.push_back(s);
+	return true;
+}
+
+void ssao_app::apply_parameter(int parameter, float value) {
+	switch (parameter) {
+	case SWEEP_POINTS:
+		point_count = std::min(std::max((unsigned int)value, 1u), 256u);
+		break;
+	case SWEEP_STEPS:
+		step_count = std::min(std::max((unsigned int)value, 1u), 16u);
+		break;
+	case SWEEP_RADIUS:
+		ssao_radius = fminf(fmaxf(value, 0.01f), 0.5f);
+		break;
+	case SWEEP_SCALE:
+		set_render_scale(fminf(fmaxf(value, 0.25f), 1.0f));
+		break;
+	case SWEEP_AO_SCALE:
+		ao_scale = value >= 4.0f ? 4 : value >= 2.0f ? 2 : 1;
+		create_ao_targets();
+		break;
+	}
+}
+
+// Renders benchmark_warmup and then benchmark_frames frames for every
+// combination of the sweeps' values and writes one CSV row per measured
+// frame: the settings, the CPU time from the start of render() to the
+// return of present(), the GPU time of the commands render() issued,
+// empty if the timer had no free query, and the percentage of pixels the
+// occlusion skipped as last read back, empty if none was. Every combination starts
+// from the same scene time and advances by 1/60 s a frame, so runs of the
+// same build render the same images. Returns false if the CSV cannot be
+// written.
+bool ssao_app::run_benchmark() {
+	const double timestep = 1.0 / 60.0;
+	const int total = benchmark_warmup + benchmark_frames;
+	std::vector<size_t> index(sweeps.size(), 0);
+	std::vector<float> cpu_ms(total), gpu_ms(total), skipped(total);
+	sb7::gpu_timer timer;
+	FILE * csv = nullptr;
+	size_t i;
+	int frame;
+
+	if (!benchmark_csv.empty()) {
+		csv = fopen(benchmark_csv.c_str(), "w");
+		if (!csv) {
+			fprintf(stderr, "Failed to open %s\n", benchmark_csv.c_str());
+			return false;
+		}
+		fprintf(csv, "points,steps,radius,scale,ao_scale,width,height,frame,cpu_ms,gpu_ms,skipped_pct\n");
+	}
+	// The sweeps are what is measured
+	dynamic_resolution = false;
+	quality_governor = false;
+	paused = false;
+	camera_path = true;
+	timer.init();
+
+	for (;;) {
+		for (i = 0; i < sweeps.size(); i++)
+			apply_parameter(sweeps[i].parameter, sweeps[i].values[index[i]]);
+		rewind();
+
+		for (frame = 0; frame < total; frame++) {
+			sb7::trace::scope trace("benchmark frame");
+			auto start = std::chrono::steady_clock::now();
+			gpu_ms[frame] = -1.0f;
+			timer.begin((unsigned int)frame);
+			render(frame * timestep);
+			timer.end();
+			present();
+			cpu_ms[frame] = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			skipped[frame] = skipped_pixels;
+			if (window)
+				glfwPollEvents();
+
+			float ms;
+			unsigned int tag;
+			while (timer.poll(ms, tag))
+				gpu_ms[tag] = ms;
+		}
+		glFinish();
+		float ms;
+		unsigned int tag;
+		while (timer.poll(ms, tag))
+			gpu_ms[tag] = ms;
+
+		double cpu_sum = 0.0, gpu_sum = 0.0, skipped_sum = 0.0;
+		int gpu_count = 0, skipped_count = 0;
+		for (frame = benchmark_warmup; frame < total; frame++) {
+			cpu_sum += cpu_ms[frame];
+			if (gpu_ms[frame] >= 0.0f) {
+				gpu_sum += gpu_ms[frame];
+				gpu_count++;
+			}
+			if (skipped[frame] >= 0.0f) {
+				skipped_sum += skipped[frame];
+				skipped_count++;
+			}
+			if (csv) {
+				fprintf(csv, "%u,%u,%.3f,%.2f,%u,%d,%d,%d,%.3f,", point_count, step_count, ssao_radius, render_scale,
+						ao_scale, render_width, render_height, frame - benchmark_warmup, cpu_ms[frame]);
+				if (gpu_ms[frame] >= 0.0f)
+					fprintf(csv, "%.3f", gpu_ms[frame]);
+				fprintf(csv, ",");
+				if (skipped[frame] >= 0.0f)
+					fprintf(csv, "%.1f", skipped[frame]);
+				fprintf(csv, "\n");
+			}
+		}
+		printf("points %u steps %u radius %.3f scale %.2f ao_scale %u (%dx%d): cpu %.2f ms, gpu %.2f ms",
+			   point_count, step_count, ssao_radius, render_scale, ao_scale, render_width, render_height,
+			   benchmark_frames ? cpu_sum / benchmark_frames : 0.0, gpu_count ? gpu_sum / gpu_count : 0.0);
+		if (skipped_count)
+			printf(", skipped %.1f%% of pixels", skipped_sum / skipped_count);
+		printf("\n");
+
+		// Next combination, the last sweep changing fastest
+		for (i = sweeps.size(); i > 0; i--) {
+			if (++index[i - 1] < sweeps[i - 1].values.size())
+				break;
+			index[i - 1] = 0;
+		}
+		if (i == 0)
+			break;
+	}
+
+	timer.free();
+	if (csv && fclose(csv) != 0) {
+		fprintf(stderr, "Failed to write %s\n", benchmark_csv.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Builds the programs the current settings need and goes back to the start
+// of the scene, so that what follows renders the same frames whatever was
+// rendered before
+void ssao_app::rewind() {
+	select_programs();
+	programs.finish();
+	select_programs();
+	total_time = last_time = 0.0;
+	frame_index = 0;
+	history_valid = false;
+	// A count in flight belongs to the settings before
+	coverage_pending = false;
+	skipped_pixels = -1.0f;
+}
+
+// Reads the finished frame back, top row first. Waits for the GPU, which
+// only the golden image check can afford; see sb7::frame_capture otherwise.
+void ssao_app::read_frame(sb7::image::rgb & image) {
+	std::vector<unsigned char> rows((size_t)info.windowWidth * info.windowHeight * 3);
+	size_t stride = (size_t)info.windowWidth * 3;
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, output_fbo);
+	if (!output_fbo)
+		glReadBuffer(GL_BACK);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, info.windowWidth, info.windowHeight, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+	image.width = info.windowWidth;
+	image.height = info.windowHeight;
+	image.pixels.resize(rows.size());
+	for (int y = 0; y < image.height; y++)
+		memcpy(&image.pixels[y * stride], &rows[(image.height - 1 - y) * stride], stride);
+}
+
+// Renders every scene below for GOLDEN_FRAMES frames from the start and
+// compares the last frame with golden_dir/<scene>.ppm. A scene fails if
+// its PSNR or SSIM falls below golden_min_psnr or golden_min_ssim, or if
+// the average GPU time of a pass over the frames after GOLDEN_WARMUP
+// exceeds its entry in golden_dir/baseline.txt by more than
+// golden_time_tolerance. Timings are only comparable on the machine that
+// wrote the baseline, so without baseline.txt only the images are checked.
+// With golden_update the references and the baseline are written instead.
+// Returns false if any scene failed or a file could not be written.
+bool ssao_app::run_golden() {
+	enum { GOLDEN_WARMUP = 8, GOLDEN_FRAMES = 24 };
+	static const struct {
+		const char *    name;
+		bool            split_passes;
+		unsigned int    ao_scale;
+		int             ao_path;
+		int             ao_technique;
+		bool            compact_gbuffer;
+	} scenes[] = {
+		{ "default", true, 1, AO_PATH_FRAGMENT, AO_TECHNIQUE_POINTS, false },
+		{ "single_pass", false, 1, AO_PATH_FRAGMENT, AO_TECHNIQUE_POINTS, false },
+		{ "half", true, 2, AO_PATH_FRAGMENT, AO_TECHNIQUE_POINTS, false },
+		{ "depth_mips", true, 1, AO_PATH_DEPTH_MIPS, AO_TECHNIQUE_POINTS, false },
+		{ "deinterleaved", true, 1, AO_PATH_DEINTERLEAVED, AO_TECHNIQUE_POINTS, false },
+		{ "compute", true, 1, AO_PATH_COMPUTE, AO_TECHNIQUE_POINTS, false },
+		{ "horizon", true, 1, AO_PATH_FRAGMENT, AO_TECHNIQUE_HORIZON, false },
+		{ "compact", true, 1, AO_PATH_FRAGMENT, AO_TECHNIQUE_POINTS, true }
+	};
+	const int scene_count = sizeof(scenes) / sizeof(scenes[0]);
+	const std::string baseline_filename = golden_dir + "/baseline.txt";
+	std::map<std::string, float> baseline;
+	FILE * baseline_file;
+	bool was_profiling = profiling;
+	bool ok = true;
+	int passed = 0;
+	int i, frame;
+
+	if (golden_update) {
+		baseline_file = fopen(baseline_filename.c_str(), "w");
+		if (!baseline_file) {
+			fprintf(stderr, "Failed to write %s\n", baseline_filename.c_str());
+			return false;
+		}
+	} else {
+		baseline_file = fopen(baseline_filename.c_str(), "r");
+		if (baseline_file) {
+			char scene[64], pass[64];
+			float ms;
+			while (fscanf(baseline_file, "%63s %63s %f", scene, pass, &ms) == 3)
+				baseline[std::string(scene) + " " + pass] = ms;
+			fclose(baseline_file);
+			baseline_file = nullptr;
+		} else {
+			printf("No %s, GPU times are not checked\n", baseline_filename.c_str());
+		}
+	}
+
+	dynamic_resolution = false;
+	quality_governor = false;
+	paused = false;
+	camera_path = false;
+	profiling = true;
+	for (i = 0; i < scene_count; i++) {
+		// Everything else the image depends on is pinned to the defaults,
+		// so that references written under one set of options are checked
+		// the same way under another
+		set_render_scale(1.0f);
+		point_count = 6;
+		step_count = 4;
+		ssao_radius = 0.05f;
+		show_shading = true;
+		show_ao = true;
+		weight_by_angle = true;
+		randomize_points = true;
+		specialize_shaders = true;
+		blur_ao = true;
+		temporal_ao = true;
+		split_passes = scenes[i].split_passes;
+		ao_scale = scenes[i].ao_scale;
+		ao_path = scenes[i].ao_path;
+		ao_technique = scenes[i].ao_technique;
+		compact_gbuffer = scenes[i].compact_gbuffer;
+		create_gbuffer();
+		create_ao_targets();
+		rewind();
+
+		sb7::image::rgb image;
+		for (frame = 0; frame < GOLDEN_FRAMES; frame++) {
+			if (frame == GOLDEN_WARMUP)
+				profiler.reset();
+			render(frame / 60.0);
+			if (frame == GOLDEN_FRAMES - 1)
+				read_frame(image);
+			present();
+			if (window)
+				glfwPollEvents();
+		}
+		glFinish();
+		profiler.update();
+
+		const std::string reference_filename = golden_dir + "/" + scenes[i].name + ".ppm";
+		float min, avg, p99;
+		int pass;
+		if (golden_update) {
+			if (!sb7::image::store_ppm(reference_filename, image)) {
+				fprintf(stderr, "Failed to write %s\n", reference_filename.c_str());
+				ok = false;
+			}
+			for (pass = 0; pass < profiler.size(); pass++) {
+				if (profiler.statistics(pass, min, avg, p99))
+					fprintf(baseline_file, "%s %s %.4f\n", scenes[i].name, profiler.name(pass), avg);
+			}
+			printf("%-14s written\n", scenes[i].name);
+			continue;
+		}
+
+		sb7::image::rgb reference;
+		if (!sb7::image::load_ppm(reference_filename, reference)) {
+			printf("%-14s FAIL: no reference %s\n", scenes[i].name, reference_filename.c_str());
+			ok = false;
+			continue;
+		}
+		if (reference.width != image.width || reference.height != image.height) {
+			printf("%-14s FAIL: rendered %dx%d, the reference is %dx%d\n", scenes[i].name,
+				   image.width, image.height, reference.width, reference.height);
+			ok = false;
+			continue;
+		}
+		double psnr = sb7::image::psnr(image, reference);
+		double ssim = sb7::image::ssim(image, reference);
+		bool scene_ok = psnr >= golden_min_psnr && ssim >= golden_min_ssim;
+		printf("%-14s %s: PSNR %.1f dB, SSIM %.4f", scenes[i].name, scene_ok ? "pass" : "FAIL", psnr, ssim);
+		if (skipped_pixels >= 0.0f)
+			printf(", occlusion skipped on %.1f%% of pixels", skipped_pixels);
+		printf("\n");
+		for (pass = 0; pass < profiler.size(); pass++) {
+			auto entry = baseline.find(std::string(scenes[i].name) + " " + profiler.name(pass));
+			if (entry == baseline.end() || !profiler.statistics(pass, min, avg, p99))
+				continue;
+			// A little absolute slack, so that passes of a few microseconds
+			// do not fail on timer resolution
+			float budget = entry->second * (1.0f + golden_time_tolerance) + 0.05f;
+			bool pass_ok = avg <= budget;
+			printf("%-14s   %-10s %8.3f ms, budget %8.3f ms%s\n", "", profiler.name(pass), avg, budget, pass_ok ? "" : "  FAIL");
+			scene_ok &= pass_ok;
+		}
+		// Keep the image that failed next to its reference
+		const std::string failed_filename = golden_dir + "/" + scenes[i].name + ".failed.ppm";
+		if (!scene_ok) {
+			sb7::image::store_ppm(failed_filename, image);
+			ok = false;
+		} else {
+			remove(failed_filename.c_str());
+			passed++;
+		}
+	}
+	profiling = was_profiling;
+
+	if (golden_update) {
+		if (fclose(baseline_file) != 0)
+			ok = false;
+		printf("References and baseline written to %s\n", golden_dir.c_str());
+	} else {
+		printf("Golden images: %d of %d scenes passed\n", passed, scene_count);
+	}
+	return ok;
+}
+
+// Starts writing frames to capture_pattern, or to numbered PNGs if it is
+// empty
+bool ssao_app::start_capture() {
+	if (capture_pattern.empty())
+		capture_pattern = "capture%05d.png";
+	if (!capture.init(capture_pattern)) {
+		fprintf(stderr, "Failed to capture to %s\n", capture_pattern.c_str());
+		capture_pattern.clear();
+		capturing = false;
+		return false;
+	}
+	capturing = true;
+	return true;
+}
+
+// Waits for the frames still being read back or written and returns false
+// if any failed to write
+bool ssao_app::finish_capture() {
+	bool ok = capture.finish();
+	printf("Captured %d frames to %s, %d written, %d stalls\n", captured_frames, capture_pattern.c_str(),
+		   capture.frames_written(), capture.stalls());
+	if (!ok)
+		fprintf(stderr, "Failed to write every captured frame\n");
+	return ok;
+}
+
+// Renders benchmark_frames frames offscreen with the benchmark's fixed
+// timestep, and returns false if GL reported an error on the way
+bool ssao_app::run_headless() {
+	int frame;
+
+	camera_path = false;
+	for (frame = 0; frame < benchmark_frames; frame++) {
+		sb7::trace::scope trace("frame");
+		render(frame / 60.0);
+		present();
+	}
+	glFinish();
+	GLenum error = glGetError();
+	if (error != GL_NO_ERROR) {
+		fprintf(stderr, "GL error 0x%04x after %d frames\n", error, frame);
+		return false;
+	}
+	printf("Rendered %d frames of %dx%d", frame, info.windowWidth, info.windowHeight);
+	if (skipped_pixels >= 0.0f)
+		printf(", occlusion skipped on %.1f%% of pixels", skipped_pixels);
+	printf("\n");
+	return true;
 }
 
 void ssao_app::load_shaders() {
-	GLuint shaders[2];
+	sb7::trace::scope trace("load_shaders");
+	programs.clear();
+	render_program = 0;
+	ssao_program = 0;
+	select_programs();
+	// There is nothing to fall back to at startup, so wait for the first builds
+	programs.finish();
+	select_programs();
+}
 
-	shaders[0] = sb7::shader::load("../media/shaders/ssao/render.vs.glsl", GL_VERTEX_SHADER);
-	shaders[1] = sb7::shader::load("../media/shaders/ssao/render.fs.glsl", GL_FRAGMENT_SHADER);
+// Picks the programs matching the current settings. Programs only needed
+// by passes that are switched off are not requested until they are enabled.
+// Every program that reads the G-buffer is built for its layout.
+void ssao_app::select_programs() {
+	char scale_defines[64];
+	char ao_defines[192];
+	char ssao_defines[64];
+	char background_defines[224];
+	char defines[96];
+	const char * gbuffer_defines = compact_gbuffer ? "#define COMPACT_GBUFFER 1\n" : "";
+	const char * technique_defines = ao_technique == AO_TECHNIQUE_HORIZON ? "#define HORIZON 1\n" : "";
 
-	if (render_program)
-		glDeleteProgram(render_program);
+	render_program = programs.get("ssao/render.vs.glsl", "ssao/render.fs.glsl", gbuffer_defines);
+	snprintf(ssao_defines, sizeof(ssao_defines), "%s%s", gbuffer_defines, technique_defines);
+	ssao_program = select_ssao_variant(ssao_defines);
+	snprintf(defines, sizeof(defines), "%s#define BACKGROUND_ONLY 1\n", ssao_defines);
+	ssao_background_program = programs.get("ssao/ssao.vs.glsl", "ssao/ssao.fs.glsl", defines);
+	if (split_passes || ao_scale > 1) {
+		snprintf(scale_defines, sizeof(scale_defines), "%s#define SCALE %u\n", gbuffer_defines, ao_scale);
+		snprintf(ao_defines, sizeof(ao_defines), "#define AO_ONLY 1\n%s%s%s", ssao_defines,
+				 blur_ao ? "#define ROTATE_POINTS 1\n" : "", temporal_ao ? "#define TEMPORAL 1\n" : "");
+		if (ao_path == AO_PATH_DEINTERLEAVED)
+			snprintf(ao_defines + strlen(ao_defines), sizeof(ao_defines) - strlen(ao_defines), "#define DEINTERLEAVED 1\n");
+		else if (ao_path == AO_PATH_DEPTH_MIPS)
+			snprintf(ao_defines + strlen(ao_defines), sizeof(ao_defines) - strlen(ao_defines), "#define DEPTH_MIPS %d\n", (int)DEPTH_MIP_LEVELS);
+		else if (ao_path == AO_PATH_COMPUTE) {
+			bool lds_only;
+			int apron = compute_apron(lds_only);
+			snprintf(ao_defines + strlen(ao_defines), sizeof(ao_defines) - strlen(ao_defines), "#define APRON %d\n%s",
+					 apron, lds_only ? "#define LDS_ONLY 1\n" : "");
+		}
+		if (ao_scale > 1)
+			downsample_program = programs.get("ssao/ssao.vs.glsl", "ssao/downsample.fs.glsl", scale_defines);
+		ao_program = select_ssao_variant(ao_defines, ao_path == AO_PATH_COMPUTE);
+		composite_program = programs.get("ssao/ssao.vs.glsl", "ssao/composite.fs.glsl", scale_defines);
+		if (ao_path == AO_PATH_DEINTERLEAVED) {
+			snprintf(background_defines, sizeof(background_defines), "%s#define BACKGROUND_ONLY 1\n", ao_defines);
+			ao_background_program = programs.get("ssao/ssao.vs.glsl", "ssao/ssao.fs.glsl", background_defines);
+			for (int i = 0; i < 2; i++) {
+				snprintf(defines, sizeof(defines), "%s#define LAYER %d\n", gbuffer_defines, i * 8);
+				deinterleave_programs[i] = programs.get("ssao/ssao.vs.glsl", "ssao/deinterleave.fs.glsl", defines);
+			}
+			reinterleave_program = programs.get("ssao/ssao.vs.glsl", "ssao/reinterleave.fs.glsl");
+		} else if (ao_path == AO_PATH_DEPTH_MIPS) {
+			snprintf(defines, sizeof(defines), "%s#define FIRST_LEVEL 1\n", gbuffer_defines);
+			depth_mip_programs[0] = programs.get("ssao/ssao.vs.glsl", "ssao/depth_mip.fs.glsl", defines);
+			depth_mip_programs[1] = programs.get("ssao/ssao.vs.glsl", "ssao/depth_mip.fs.glsl");
+		}
+		if (temporal_ao)
+			temporal_program = programs.get("ssao/ssao.vs.glsl", "ssao/temporal.fs.glsl", scale_defines);
+		if (blur_ao) {
+			for (int i = 0; i < 2; i++) {
+				snprintf(defines, sizeof(defines), "%s#define AXIS %d\n", gbuffer_defines, i);
+				blur_programs[i] = programs.get("ssao/ssao.vs.glsl", "ssao/blur.fs.glsl", defines);
+			}
+		}
+	}
+}
 
-	render_program = sb7::program::link_from_shaders(shaders, 2, true);
-	uniforms.render.mv_matrix = glGetUniformLocation(render_program, "mv_matrix");
-	uniforms.render.proj_matrix = glGetUniformLocation(render_program, "proj_matrix");
-	uniforms.render.shading_level = glGetUniformLocation(render_program, "shading_level");
-	shaders[0] = sb7::shader::load("../media/shaders/ssao/ssao.vs.glsl", GL_VERTEX_SHADER);
-	shaders[1] = sb7::shader::load("../media/shaders/ssao/ssao.fs.glsl", GL_FRAGMENT_SHADER);
-	ssao_program = sb7::program::link_from_shaders(shaders, 2, true);
-	uniforms.ssao.ssao_radius = glGetUniformLocation(ssao_program, "ssao_radius");
-	uniforms.ssao.ssao_level = glGetUniformLocation(ssao_program, "ssao_level");
-	uniforms.ssao.object_level = glGetUniformLocation(ssao_program, "object_level");
-	uniforms.ssao.weight_by_angle = glGetUniformLocation(ssao_program, "weight_by_angle");
-	uniforms.ssao.randomize_points = glGetUniformLocation(ssao_program, "randomize_points");
-	uniforms.ssao.point_count = glGetUniformLocation(ssao_program, "point_count");
+// ssao_radius in G-buffer pixels, as SSAO_PASS passes it on
+float ssao_app::pass_radius() const {
+	return ssao_radius * float(render_width) / 1000.0f * float(REFERENCE_TARGET_WIDTH);
+}
+
+// The apron ssao.cs.glsl copies around each tile into shared memory. Taps
+// reach at most 1.6 radii for point marching (four steps of up to 0.4) and
+// 1.5 for horizons, in occlusion texels; rounded up to a multiple of 8,
+// so that a changing render scale rarely needs a new variant. If the tile
+// with that apron fits in shared memory, lds_only is set and every tap
+// reads shared memory. Otherwise the kernel keeps a 16 texel apron and
+// taps beyond it read the texture, so it is not LDS-only: at the default
+// radius that is the common case below quarter resolution.
+int ssao_app::compute_apron(bool & lds_only) const {
+	const int tile = 16;
+	int reach = (int)ceilf(1.6f * pass_radius() / float(ao_scale)) + 1;
+	int apron = (reach + 7) / 8 * 8;
+	size_t bytes = (size_t)(tile + 2 * apron) * (tile + 2 * apron) * sizeof(float);
+	lds_only = bytes <= (size_t)max_shared_memory;
+	return lds_only ? apron : 16;
+}
+
+// Returns the ssao.fs.glsl permutation, or with compute the ssao.cs.glsl
+// one, for the current settings.
+// Specialized variants bake point_count, step_count, randomize_points and
+// weight_by_angle in as constants; while one is still compiling the generic
+// program is used.
+GLuint ssao_app::select_ssao_variant(const char * base_defines, bool compute) {
+	const char * vs = compute ? "" : "ssao/ssao.vs.glsl";
+	const char * fs = compute ? "ssao/ssao.cs.glsl" : "ssao/ssao.fs.glsl";
+	GLuint program = programs.get(vs, fs, base_defines);
+	if (specialize_shaders) {
+		char defines[320];
+		snprintf(defines, sizeof(defines),
+				 "%s"
+				 "#define POINT_COUNT %uu\n"
+				 "#define STEP_COUNT %d\n"
+				 "#define RANDOMIZE_POINTS %d\n"
+				 "#define WEIGHT_BY_ANGLE %d\n",
+				 base_defines,
+				 point_count < 256 ? point_count : 256,
+				 (int)step_count,
+				 randomize_points ? 1 : 0,
+				 weight_by_angle ? 1 : 0);
+		GLuint variant = programs.get(vs, fs, defines);
+		if (variant)
+			program = variant;
+	}
+	return program;
 }
 
 void ssao_app::onKey(int key, int action) {
@@ -328,10 +2197,14 @@ void ssao_app::onKey(int key, int action) {
 			randomize_points = !randomize_points;
 			break;
 		case 'S':
-			point_count++;
+			if (point_count < 256)
+				point_count++;
+			quality_governor = false;
 			break;
 		case 'X':
-			point_count--;
+			if (point_count > 1)
+				point_count--;
+			quality_governor = false;
 			break;
 		case 'Q':
 			show_shading = !show_shading;
@@ -340,16 +2213,80 @@ void ssao_app::onKey(int key, int action) {
 			show_ao = !show_ao;
 			break;
 		case 'A':
-			ssao_radius += 0.01f;
+			ssao_radius = fminf(ssao_radius + 0.01f, 0.5f);
 			break;
 		case 'Z':
-			ssao_radius -= 0.01f;
+			ssao_radius = fmaxf(ssao_radius - 0.01f, 0.01f);
 			break;
 		case 'P':
 			paused = !paused;
 			break;
+		case 'V':
+			specialize_shaders = !specialize_shaders;
+			break;
+		case 'H':
+			ao_scale = ao_scale < 4 ? ao_scale * 2 : 1;
+			create_ao_targets();
+			break;
+		case 'C':
+			split_passes = !split_passes;
+			break;
+		case 'B':
+			blur_ao = !blur_ao;
+			break;
+		case 'M':
+			ao_path = ao_path == AO_PATH_DEPTH_MIPS ? AO_PATH_FRAGMENT : AO_PATH_DEPTH_MIPS;
+			break;
+		case 'I':
+			ao_path = ao_path == AO_PATH_DEINTERLEAVED ? AO_PATH_FRAGMENT : AO_PATH_DEINTERLEAVED;
+			break;
+		case 'T':
+			temporal_ao = !temporal_ao;
+			break;
+		case 'K':
+			ao_path = ao_path == AO_PATH_COMPUTE ? AO_PATH_FRAGMENT : AO_PATH_COMPUTE;
+			break;
+		case 'G':
+			ao_technique = ao_technique == AO_TECHNIQUE_HORIZON ? AO_TECHNIQUE_POINTS : AO_TECHNIQUE_HORIZON;
+			break;
+		case 'O':
+			compact_gbuffer = !compact_gbuffer;
+			create_gbuffer();
+			create_ao_targets();
+			break;
+		case 'D':
+			dynamic_resolution = !dynamic_resolution;
+			set_render_scale(dynamic_resolution ? max_render_scale : 1.0f);
+			break;
+		case 'Y':
+			quality_governor = !quality_governor;
+			if (quality_governor)
+				start_governor();
+			break;
+		case 'F':
+			profiling = !profiling;
+			if (profiling)
+				profiler.reset();
+			else
+				report_profile();
+			break;
+		case 'E':
+			if (!capture_pattern.empty())
+				capturing = !capturing;
+			else
+				start_capture();
+			break;
+		case 'J':
+			if (sb7::trace::enabled()) {
+				write_trace();
+			} else {
+				if (trace_filename.empty())
+					trace_filename = "trace.json";
+				sb7::trace::enable(true);
+			}
+			break;
 		case 'L':
-			load_shaders();
+			programs.reload();
 			break;
             default:
                 break;
@@ -360,11 +2297,15 @@ void ssao_app::onKey(int key, int action) {
 ssao_app * ssao_app::ssao_app::app = nullptr;
 
 #ifdef __linux__
-int main() {
+int main(int argc, char ** argv) {
     auto app = new ssao_app;
-    app->run(app);
+    if (!app->parse_arguments(argc, argv)) {
+        delete app;
+        return 1;
+    }
+    int status = app->run(app);
     delete app;
-    return 0;
+    return status;
 }
 #endif
 
@@ -378,9 +2319,13 @@ int CALLBACK WinMain(HINSTANCE hInstance,           \
                      int nCmdShow)                  \
 {                                                   \
     a *app = new a;                                 \
-    app->run(app);                                  \
+    if (!app->parse_arguments(__argc, __argv)) {    \
+        delete app;                                 \
+        return 1;                                   \
+    }                                               \
+    int status = app->run(app);                     \
     delete app;                                     \
-    return 0;                                       \
+    return status;                                  \
 }
 DECLARE_MAIN(ssao_app)
 #endif
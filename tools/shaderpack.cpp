@@ -0,0 +1,113 @@
+// Packs shader sources into a single indexed file, see shaderpack.h.
+//
+//     shaderpack <output> <root> <file>...
+//
+// Every file is stored under its path relative to root, which is also the
+// name the application asks for at runtime (e.g. "ssao/ssao.fs.glsl").
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define SBPK_FILETYPES_ONLY
+#include "../shaderpack.h"
+
+static bool read_file(const std::string & filename, std::string & text) {
+	FILE * fp = fopen(filename.c_str(), "rb");
+	if (!fp)
+		return false;
+	fseek(fp, 0, SEEK_END);
+	long filesize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	text.resize(filesize > 0 ? (size_t)filesize : 0);
+	if (filesize > 0)
+		fread(&text[0], 1, text.size(), fp);
+	fclose(fp);
+	return true;
+}
+
+int main(int argc, char ** argv) {
+	if (argc < 4) {
+		fprintf(stderr, "usage: %s <output> <root> <file>...\n", argv[0]);
+		return 1;
+	}
+
+	std::string root(argv[2]);
+	if (!root.empty() && root[root.size() - 1] != '/' && root[root.size() - 1] != '\\')
+		root += '/';
+
+	std::vector<std::string> names;
+	std::vector<std::string> sources;
+	for (int i = 3; i < argc; i++) {
+		std::string path(argv[i]);
+		std::string name = path.compare(0, root.size(), root) == 0 ? path.substr(root.size()) : path;
+		for (size_t j = 0; j < name.size(); j++) {
+			if (name[j] == '\\')
+				name[j] = '/';
+		}
+		std::string text;
+		if (!read_file(path, text)) {
+			fprintf(stderr, "%s: unable to read\n", path.c_str());
+			return 1;
+		}
+		names.push_back(name);
+		sources.push_back(text);
+	}
+
+	// Keep the table at most half full so probes stay short
+	unsigned int bucket_count = 1;
+	while (bucket_count < names.size() * 2)
+		bucket_count <<= 1;
+
+	SBPK_HEADER header;
+	header.magic = SBPK_MAGIC;
+	header.version = SBPK_VERSION;
+	header.entry_count = (unsigned int)names.size();
+	header.bucket_count = bucket_count;
+
+	std::vector<SBPK_ENTRY> entries(bucket_count);
+	memset(&entries[0], 0, bucket_count * sizeof(SBPK_ENTRY));
+	std::string blob;
+	size_t blob_start = sizeof(SBPK_HEADER) + bucket_count * sizeof(SBPK_ENTRY);
+
+	for (size_t i = 0; i < names.size(); i++) {
+		SBPK_ENTRY e;
+		e.hash = sbpk_hash(names[i].c_str(), names[i].size());
+		e.name_offset = (unsigned int)(blob_start + blob.size());
+		e.name_length = (unsigned int)names[i].size();
+		blob += names[i];
+		blob += '\0';
+		e.data_offset = (unsigned int)(blob_start + blob.size());
+		e.data_length = (unsigned int)sources[i].size();
+		blob += sources[i];
+		blob += '\0';
+
+		unsigned int slot = e.hash & (bucket_count - 1);
+		while (entries[slot].name_length != 0) {
+			if (entries[slot].hash == e.hash && names[i] == std::string(blob, entries[slot].name_offset - blob_start, entries[slot].name_length)) {
+				fprintf(stderr, "%s: listed twice\n", names[i].c_str());
+				return 1;
+			}
+			slot = (slot + 1) & (bucket_count - 1);
+		}
+		entries[slot] = e;
+	}
+
+	FILE * fp = fopen(argv[1], "wb");
+	if (!fp) {
+		fprintf(stderr, "%s: unable to write\n", argv[1]);
+		return 1;
+	}
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(&entries[0], sizeof(SBPK_ENTRY), bucket_count, fp);
+	fwrite(blob.data(), 1, blob.size(), fp);
+	bool ok = ferror(fp) == 0;
+	ok &= fclose(fp) == 0;
+	if (!ok) {
+		fprintf(stderr, "%s: write failed\n", argv[1]);
+		remove(argv[1]);
+		return 1;
+	}
+	return 0;
+}
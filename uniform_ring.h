@@ -0,0 +1,107 @@
+#ifndef __UNIFORM_RING_H__
+#define __UNIFORM_RING_H__
+
+#include <cstdio>
+#include <cstring>
+#include "gl3w.h"
+
+namespace sb7 {
+	// Streams the small, short-lived uniform blocks of a frame to the GPU.
+	// One buffer is split into a segment per frame in flight; blocks written
+	// during a frame are packed into its segment and bound with
+	// glBindBufferRange. A fence per segment guarantees the GPU is done with
+	// a segment before it is written again. With GL 4.4 the buffer stays
+	// persistently mapped, otherwise each block is a glBufferSubData.
+	class uniform_ring {
+	public:
+		uniform_ring() : buffer(0), mapped(nullptr), segment_size(0), alignment(256), segment(0), offset(0) {
+			for (int i = 0; i < SEGMENTS; i++)
+				fences[i] = 0;
+		}
+		~uniform_ring() {}
+
+		void init(GLsizeiptr bytes_per_frame) {
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			segment_size = align(bytes_per_frame);
+			glGenBuffers(1, &buffer);
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			if (gl3wIsSupported(4, 4)) {
+				const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+				glBufferStorage(GL_UNIFORM_BUFFER, segment_size * SEGMENTS, nullptr, flags);
+				mapped = (char *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, segment_size * SEGMENTS, flags);
+			} else {
+				glBufferData(GL_UNIFORM_BUFFER, segment_size * SEGMENTS, nullptr, GL_STREAM_DRAW);
+			}
+		}
+
+		void free() {
+			for (int i = 0; i < SEGMENTS; i++) {
+				if (fences[i])
+					glDeleteSync(fences[i]);
+				fences[i] = 0;
+			}
+			if (mapped) {
+				glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+				glUnmapBuffer(GL_UNIFORM_BUFFER);
+			}
+			glDeleteBuffers(1, &buffer);
+			buffer = 0;
+			mapped = nullptr;
+		}
+
+		// Moves on to the next segment, waiting for the GPU to release it.
+		// With SEGMENTS frames in flight the fence has virtually always
+		// signalled by now.
+		void begin_frame() {
+			segment = (segment + 1) % SEGMENTS;
+			offset = 0;
+			if (fences[segment]) {
+				glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+				glDeleteSync(fences[segment]);
+				fences[segment] = 0;
+			}
+		}
+
+		void end_frame() {
+			fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+
+		// Copies a block into this frame's segment and binds it to binding.
+		void bind(GLuint binding, const void * data, GLsizeiptr size) {
+			if (offset + size > segment_size) {
+				fprintf(stderr, "uniform_ring: %d bytes per frame is not enough\n", (int)segment_size);
+				return;
+			}
+			GLintptr at = segment * segment_size + offset;
+			if (mapped) {
+				memcpy(mapped + at, data, size);
+			} else {
+				glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+				glBufferSubData(GL_UNIFORM_BUFFER, at, size, data);
+			}
+			glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, at, size);
+			offset += align(size);
+		}
+
+		template <typename T>
+		void bind(GLuint binding, const T & block) {
+			bind(binding, &block, sizeof(T));
+		}
+
+	private:
+		enum { SEGMENTS = 3 };
+
+		GLsizeiptr align(GLsizeiptr size) const {
+			return (size + alignment - 1) / alignment * alignment;
+		}
+
+		GLuint      buffer;
+		char *      mapped;
+		GLsizeiptr  segment_size;
+		GLint       alignment;
+		int         segment;
+		GLsizeiptr  offset;
+		GLsync      fences[SEGMENTS];
+	};
+}
+#endif /* __UNIFORM_RING_H__ */